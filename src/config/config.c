@@ -69,6 +69,9 @@ bool cXVDRServerConfig::Parse(const char* Name, const char* Value)
 {
   if     (!strcasecmp(Name, "TimeShiftDir")) cLiveQueue::SetTimeShiftDir(Value);
   else if(!strcasecmp(Name, "MaxTimeShiftSize")) cLiveQueue::SetBufferSize(strtoull(Value, NULL, 10));
+  else if(!strcasecmp(Name, "MaxLiveQueueSize")) cLiveQueue::SetQueueSize(strtoull(Value, NULL, 10));
+  else if(!strcasecmp(Name, "MaxLiveQueueDelay")) cLiveQueue::SetQueueDelay(strtoul(Value, NULL, 10));
+  else if(!strcasecmp(Name, "TimeShiftRamTime")) cLiveQueue::SetRamTime(strtoul(Value, NULL, 10));
   else if(!strcasecmp(Name, "PiconsURL")) PiconsURL = Value;
   else if(!strcasecmp(Name, "ReorderCmd")) ReorderCmd = Value;
   else return false;
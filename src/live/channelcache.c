@@ -68,6 +68,9 @@ bool cChannelCache::IsParsed() {
 void cChannelCache::CreateDemuxers(cLiveStreamer* streamer) {
   cChannelCache old;
 
+  cTSDemuxer** pidmap = new cTSDemuxer*[MAXPID];
+  memset(pidmap, 0, MAXPID * sizeof(cTSDemuxer*));
+
   // remove old demuxers
   for (std::list<cTSDemuxer*>::iterator i = streamer->m_Demuxers.begin(); i != streamer->m_Demuxers.end(); i++) {
     old.AddStream(*(*i));
@@ -93,9 +96,12 @@ void cChannelCache::CreateDemuxers(cLiveStreamer* streamer) {
     {
       dmx->info();
       streamer->m_Demuxers.push_back(dmx);
+      pidmap[infonew.GetPID() & (MAXPID - 1)] = dmx;
       streamer->AddPid(infonew.GetPID());
     }
   }
+
+  streamer->SetPidMap(pidmap);
 }
 
 bool cChannelCache::operator ==(const cChannelCache& c) const {
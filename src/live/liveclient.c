@@ -0,0 +1,324 @@
+/*
+ *      vdr-plugin-xvdr - XVDR server plugin for VDR
+ *
+ *      Copyright (C) 2010 Alwin Esch (Team XBMC)
+ *      Copyright (C) 2010, 2011 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-xvdr
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <vdr/device.h>
+
+#include "config/config.h"
+#include "net/msgpacket.h"
+#include "tools/hash.h"
+
+#include "liveclient.h"
+#include "livestreamer.h"
+#include "livequeue.h"
+
+cLiveClient::cLiveClient(int priority, uint32_t timeout, uint32_t protocolVersion)
+{
+  m_Streamer        = NULL;
+  m_Queue           = NULL;
+  m_TimeShift       = NULL;
+  m_TimeShiftMode   = false;
+  m_priority        = priority;
+  m_scanTimeout     = timeout;
+  m_protocolVersion = protocolVersion;
+  m_LangStreamType  = cStreamInfo::stMPEG2AUDIO;
+  m_LanguageIndex   = -1;
+  m_startup         = true;
+  m_waitforiframe   = false;
+
+  m_requestStreamChange = false;
+}
+
+cLiveClient::~cLiveClient()
+{
+  // stop receiving packets before the queue goes away
+  cLiveStreamer::Unsubscribe(this, m_Streamer);
+  m_Streamer = NULL;
+
+  delete m_Queue;
+}
+
+int cLiveClient::StreamChannel(const cChannel *channel, int sock, bool waitforiframe)
+{
+  m_waitforiframe = waitforiframe;
+
+  if(m_waitforiframe) {
+    INFOLOG("Will wait for first I-Frame ...");
+  }
+
+  // create send queue
+  if (m_Queue == NULL)
+  {
+    m_Queue = new cLiveQueue(sock);
+    m_Queue->Start();
+  }
+
+  int status = XVDR_RET_ERROR;
+  m_Streamer = cLiveStreamer::Subscribe(this, channel, m_priority, m_scanTimeout, status);
+
+  return status;
+}
+
+void cLiveClient::sendStreamPacket(sStreamPacket *pkt, MsgPayload *payload)
+{
+  // in timeshift mode the packet was stored by the streamer
+  if (m_TimeShiftMode)
+  {
+    m_Queue->Notify();
+    return;
+  }
+
+  // Send stream information as the first packet on startup
+  if (m_startup)
+  {
+    // wait for first I-Frame (if enabled)
+    if(m_waitforiframe && pkt->frametype != cStreamInfo::ftIFRAME) {
+      return;
+    }
+
+    INFOLOG("streaming of channel started");
+    m_requestStreamChange = true;
+    m_startup = false;
+  }
+
+  // send stream change on demand
+  if(m_requestStreamChange)
+    sendStreamChange();
+
+  m_Queue->Add(CreateStreamPacket(pkt, payload, m_protocolVersion));
+}
+
+MsgPacket* cLiveClient::CreateStreamPacket(sStreamPacket *pkt, MsgPayload *payload, uint32_t protocolVersion)
+{
+  // initialise stream packet
+  // stream packets are never answered and don't need a unique id
+  MsgPacket* packet = new MsgPacket(XVDR_STREAM_MUXPKT, XVDR_CHANNEL_STREAM, 0, false);
+  packet->disablePayloadCheckSum();
+
+  // write stream data
+  packet->put_U16(pkt->pid);
+  packet->put_S64(pkt->pts);
+  packet->put_S64(pkt->dts);
+  if(protocolVersion >= 5) {
+    packet->put_U32(pkt->duration);
+  }
+
+  // write frame type into unused header field clientid
+  packet->setClientID((uint16_t)pkt->frametype);
+
+  // attach the (shared) payload to the stream packet
+  packet->put_U32(pkt->size);
+  packet->attachPayload(payload);
+
+  return packet;
+}
+
+void cLiveClient::sendStreamChange()
+{
+  m_Queue->Add(m_Streamer->CreateStreamChange(m_LanguageIndex, m_LangStreamType, m_protocolVersion));
+  m_requestStreamChange = false;
+}
+
+void cLiveClient::sendDetach()
+{
+  INFOLOG("sending detach message");
+  MsgPacket* resp = new MsgPacket(XVDR_STREAM_DETACH, XVDR_CHANNEL_STREAM);
+  m_Queue->Add(resp);
+}
+
+void cLiveClient::sendStatus(int status)
+{
+  MsgPacket* packet = new MsgPacket(XVDR_STREAM_STATUS, XVDR_CHANNEL_STREAM);
+  packet->put_U32(status);
+  m_Queue->Add(packet);
+}
+
+void cLiveClient::RequestSignalInfo()
+{
+  // do not send (and pollute the client with) signal information
+  // if we are paused
+  if(m_Streamer == NULL || IsPaused())
+    return;
+
+  MsgPacket* resp = new MsgPacket(XVDR_STREAM_SIGNALINFO, XVDR_CHANNEL_STREAM);
+
+  int DeviceNumber = m_Streamer->m_Device->DeviceNumber() + 1;
+  int Strength = 0;
+  int Quality = 0;
+
+  if(!TimeShiftMode()) {
+    Strength = m_Streamer->m_Device->SignalStrength();
+    Quality = m_Streamer->m_Device->SignalQuality();
+  }
+
+  resp->put_String(*cString::sprintf("%s #%d - %s", 
+#if VDRVERSNUM < 10728
+#warning "VDR versions < 1.7.28 do not support all features"
+			"Unknown",
+			DeviceNumber,
+			"Unknown"));
+#else
+			(const char*)m_Streamer->m_Device->DeviceType(),
+			DeviceNumber,
+			(const char*)m_Streamer->m_Device->DeviceName()));
+#endif
+
+  // Quality:
+  // 4 - NO LOCK
+  // 3 - NO SYNC
+  // 2 - NO VITERBI
+  // 1 - NO CARRIER
+  // 0 - NO SIGNAL
+
+  if(TimeShiftMode())
+  {
+    resp->put_String("TIMESHIFT");
+  }
+  else if(Quality == -1)
+  {
+    resp->put_String("UNKNOWN (Incompatible device)");
+    Quality = 0;
+  }
+  else
+    resp->put_String(*cString::sprintf("%s:%s:%s:%s:%s", 
+			(Quality > 4) ? "LOCKED" : "-",
+			(Quality > 0) ? "SIGNAL" : "-",
+			(Quality > 1) ? "CARRIER" : "-",
+			(Quality > 2) ? "VITERBI" : "-",
+			(Quality > 3) ? "SYNC" : "-"));
+
+  resp->put_U32((Strength << 16 ) / 100);
+  resp->put_U32((Quality << 16 ) / 100);
+  resp->put_U32(0);
+  resp->put_U32(0);
+
+  // get provider & service information
+  const cChannel* channel = FindChannelByUID(m_Streamer->m_uid);
+  if(channel != NULL) {
+    // put in provider name
+    resp->put_String(channel->Provider());
+
+    // what the heck should be the service name ?
+    // using PortalName for now
+    resp->put_String(channel->PortalName());
+  }
+  else {
+    resp->put_String("");
+    resp->put_String("");
+  }
+
+  DEBUGLOG("RequestSignalInfo");
+  m_Queue->Add(resp);
+}
+
+void cLiveClient::SetLanguage(int lang, cStreamInfo::Type streamtype)
+{
+  if(lang == -1)
+    return;
+
+  m_LanguageIndex = lang;
+  m_LangStreamType = streamtype;
+}
+
+bool cLiveClient::IsPaused()
+{
+  if(m_Queue == NULL)
+    return false;
+
+  return m_Queue->IsPaused();
+}
+
+bool cLiveClient::TimeShiftMode()
+{
+  if(m_Queue == NULL)
+    return false;
+
+  return m_Queue->TimeShiftMode();
+}
+
+void cLiveClient::Pause(bool on)
+{
+  if(m_Queue == NULL)
+    return;
+
+  // switch to the timeshift buffer of the channel
+  if(on && m_Streamer != NULL && !m_Queue->TimeShiftMode())
+  {
+    if(!m_Streamer->StartTimeShift(this))
+      ERRORLOG("Unable to start timeshift !");
+
+    return;
+  }
+
+  m_Queue->Pause(on);
+}
+
+void cLiveClient::RequestPacket()
+{
+  if(m_Queue == NULL)
+    return;
+
+  m_Queue->Request();
+}
+
+void cLiveClient::AddCredit(uint32_t packets, uint32_t bytes)
+{
+  if(m_Queue == NULL)
+    return;
+
+  m_Queue->AddCredit(packets, bytes);
+}
+
+bool cLiveClient::Seek(int64_t ts, bool relative, int64_t& position)
+{
+  if(m_Queue == NULL)
+    return false;
+
+  // seeking in the live stream switches to the background timeshift buffer
+  if(m_Streamer != NULL && !m_Queue->TimeShiftMode())
+  {
+    if(!m_Streamer->StartTimeShift(this))
+      return false;
+
+    m_Queue->Pause(false);
+  }
+
+  return m_Queue->Seek(ts, relative, position);
+}
+
+bool cLiveClient::SetSpeed(int speed)
+{
+  if(m_Queue == NULL)
+    return false;
+
+  return m_Queue->SetSpeed(speed);
+}
+
+bool cLiveClient::GetTimeRange(int64_t& first, int64_t& last)
+{
+  if(m_Queue == NULL)
+    return false;
+
+  return m_Queue->GetTimeRange(first, last);
+}
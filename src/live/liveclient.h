@@ -0,0 +1,90 @@
+/*
+ *      vdr-plugin-xvdr - XVDR server plugin for VDR
+ *
+ *      Copyright (C) 2010 Alwin Esch (Team XBMC)
+ *      Copyright (C) 2010, 2011 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-xvdr
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef XVDR_LIVECLIENT_H
+#define XVDR_LIVECLIENT_H
+
+#include "demuxer/demuxer.h"
+#include "xvdr/xvdrcommand.h"
+
+class cChannel;
+class cLiveStreamer;
+class cLiveQueue;
+class MsgPayload;
+class MsgPacket;
+class cTimeShiftBuffer;
+
+/**
+ * Live stream of a single client.
+ * Receives the packets of a (shared) channel streamer and sends them
+ * through the client's queue.
+ */
+class cLiveClient
+{
+private:
+  friend class cLiveStreamer;
+
+  void sendStreamPacket(sStreamPacket *pkt, MsgPayload *payload);
+  void sendStreamChange();
+  void sendStatus(int status);
+  void sendDetach();
+
+  void RequestStreamChange() { m_requestStreamChange = true; }
+
+  static MsgPacket* CreateStreamPacket(sStreamPacket *pkt, MsgPayload *payload, uint32_t protocolVersion);
+
+  cLiveStreamer    *m_Streamer;                     /*!> The channel streamer we are attached to */
+  cLiveQueue       *m_Queue;
+  cTimeShiftBuffer *m_TimeShift;                    /*!> Timeshift buffer of the channel (owned by the streamer) */
+  bool              m_TimeShiftMode;                /*!> Reading from the timeshift buffer */
+  int               m_priority;
+  uint32_t          m_scanTimeout;
+  uint32_t          m_protocolVersion;
+  int               m_LanguageIndex;
+  cStreamInfo::Type m_LangStreamType;
+  bool              m_startup;
+  bool              m_requestStreamChange;
+  bool              m_waitforiframe;
+
+public:
+  cLiveClient(int priority, uint32_t timeout = 0, uint32_t protocolVersion = XVDR_PROTOCOLVERSION);
+  virtual ~cLiveClient();
+
+  int StreamChannel(const cChannel *channel, int sock, bool waitforiframe = false);
+
+  bool IsPaused();
+  bool TimeShiftMode();
+
+  void SetLanguage(int lang, cStreamInfo::Type streamtype = cStreamInfo::stAC3);
+  void Pause(bool on);
+  void RequestPacket();
+  void AddCredit(uint32_t packets, uint32_t bytes);
+  bool Seek(int64_t ts, bool relative, int64_t& position);
+  bool SetSpeed(int speed);
+  bool GetTimeRange(int64_t& first, int64_t& last);
+  void RequestSignalInfo();
+};
+
+#endif // XVDR_LIVECLIENT_H
@@ -382,9 +382,9 @@ void cLivePatFilter::Process(u_short Pid, u_char Tid, const u_char *Data, int Le
     }
 
     // unable to attach receiver
+    // (the streamer thread will notify the clients)
     if(c == 3) {
       ERRORLOG("failed to attach receiver, sending detach ...");
-      m_Streamer->sendDetach();
     }
 
     m_Streamer->m_FilterMutex.Unlock();
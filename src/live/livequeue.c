@@ -23,19 +23,42 @@
  */
 
 #include <sys/types.h>
+#include <sys/socket.h>
 #include <dirent.h>
 #include <unistd.h>
 
+#ifdef __FreeBSD__
+#include <sys/endian.h>
+#else
+#include <endian.h>
+#endif
+
 #include "config/config.h"
 #include "net/msgpacket.h"
+#include "xvdr/xvdrcommand.h"
+#include "demuxer/demuxer.h"
 #include "livequeue.h"
+#include "timeshiftbuffer.h"
 
 cString cLiveQueue::TimeShiftDir = "/video";
 uint64_t cLiveQueue::BufferSize = 1024*1024*1024;
+uint64_t cLiveQueue::QueueSize = 8*1024*1024;
+uint32_t cLiveQueue::QueueDelay = 3000;
+uint32_t cLiveQueue::BufferCount = 0;
+uint32_t cLiveQueue::RamTime = 0;
+
+// stream time (in microseconds) skipped per I-Frame and speed unit in trick play mode
+#define TRICKPLAY_STEP 500000
 
-cLiveQueue::cLiveQueue(int sock) : m_socket(sock), m_readfd(-1), m_writefd(-1)
+// the credit saturates, a client may grant "unlimited" credit repeatedly
+#define MAX_CREDIT_PACKETS 0xFFFFFFFFU
+#define MAX_CREDIT_BYTES 0xFFFFFFFFFFFFULL
+
+cLiveQueue::cLiveQueue(int sock) : m_socket(sock), m_buffer(NULL), m_readpos(0), m_readts(DVD_NOPTS_VALUE), m_speed(1), m_creditPackets(0), m_creditBytes(0)
 {
   m_pause = false;
+  m_bytes = 0;
+  m_skipFrames = false;
 }
 
 cLiveQueue::~cLiveQueue()
@@ -44,46 +67,282 @@ cLiveQueue::~cLiveQueue()
   m_cond.Signal();
   Cancel(3);
   Cleanup();
-  CloseTimeShift();
+
+  if(m_buffer != NULL)
+    m_buffer->unref();
 }
 
 void cLiveQueue::Cleanup()
 {
   cMutexLock lock(&m_lock);
   while(!empty())
+    delete PopPacket();
+}
+
+void cLiveQueue::PushPacket(MsgPacket* p)
+{
+  m_bytes += p->getPacketLength();
+  push_back(p);
+}
+
+MsgPacket* cLiveQueue::PopPacket()
+{
+  MsgPacket* p = front();
+  pop_front();
+
+  m_bytes -= p->getPacketLength();
+  return p;
+}
+
+cLiveQueue::iterator cLiveQueue::DropPacket(iterator i)
+{
+  m_bytes -= (*i)->getPacketLength();
+  delete *i;
+
+  return erase(i);
+}
+
+cStreamInfo::FrameType cLiveQueue::GetFrameType(MsgPacket* p)
+{
+  // the frame type of stream packets is stored in the client id
+  if(p->getMsgID() != XVDR_STREAM_MUXPKT || p->getType() != XVDR_CHANNEL_STREAM)
+    return cStreamInfo::ftUNKNOWN;
+
+  return (cStreamInfo::FrameType)p->getClientID();
+}
+
+int64_t cLiveQueue::GetTimeStamp(MsgPacket* p)
+{
+  if(p->getMsgID() != XVDR_STREAM_MUXPKT || p->getType() != XVDR_CHANNEL_STREAM)
+    return DVD_NOPTS_VALUE;
+
+  // pid (U16), pts (S64), dts (S64)
+  if(p->getPayloadLength() < 18)
+    return DVD_NOPTS_VALUE;
+
+  int64_t pts;
+  int64_t dts;
+  memcpy(&pts, p->getPayload() + 2, sizeof(pts));
+  memcpy(&dts, p->getPayload() + 10, sizeof(dts));
+
+  pts = (int64_t)be64toh(pts);
+  dts = (int64_t)be64toh(dts);
+
+  return (dts != DVD_NOPTS_VALUE) ? dts : pts;
+}
+
+uint32_t cLiveQueue::GetDelay()
+{
+  int64_t first = DVD_NOPTS_VALUE;
+  int64_t last = DVD_NOPTS_VALUE;
+
+  for(iterator i = begin(); i != end() && first == DVD_NOPTS_VALUE; i++)
+    first = GetTimeStamp(*i);
+
+  for(reverse_iterator i = rbegin(); i != rend() && last == DVD_NOPTS_VALUE; i++)
+    last = GetTimeStamp(*i);
+
+  // timestamps are in microseconds
+  if(first == DVD_NOPTS_VALUE || last == DVD_NOPTS_VALUE || last < first)
+    return 0;
+
+  return (uint32_t)((last - first) / 1000);
+}
+
+bool cLiveQueue::IsOverloaded()
+{
+  return (m_bytes > QueueSize || GetDelay() > QueueDelay);
+}
+
+void cLiveQueue::DropFrames()
+{
+  int dropped = 0;
+
+  // drop B-Frames first
+  for(iterator i = begin(); i != end();)
+  {
+    cStreamInfo::FrameType type = GetFrameType(*i);
+
+    if(type == cStreamInfo::ftBFRAME || type == cStreamInfo::ftDFRAME) {
+      i = DropPacket(i);
+      dropped++;
+    }
+    else
+      i++;
+  }
+
+  if(!IsOverloaded())
   {
-    delete front();
-    pop();
+    DEBUGLOG("client too slow, dropped %i B-Frames", dropped);
+    return;
   }
+
+  // drop P-Frames (and all video frames depending on them) up to the next I-Frame
+  iterator i = begin();
+
+  while(i != end() && GetFrameType(*i) != cStreamInfo::ftPFRAME)
+    i++;
+
+  while(i != end())
+  {
+    cStreamInfo::FrameType type = GetFrameType(*i);
+
+    if(type == cStreamInfo::ftIFRAME)
+      break;
+
+    // audio, subtitles and control messages are never dropped
+    if(type != cStreamInfo::ftUNKNOWN) {
+      i = DropPacket(i);
+      dropped++;
+    }
+    else
+      i++;
+  }
+
+  // no I-Frame in queue -> skip incoming video frames until the next one
+  if(i == end())
+    m_skipFrames = true;
+
+  DEBUGLOG("client too slow, dropped %i video frames", dropped);
 }
 
 void cLiveQueue::Request()
 {
   cMutexLock lock(&m_lock);
 
-  // read packet from storage
-  MsgPacket* p = MsgPacket::read(m_readfd, 1000);
+  if(m_buffer == NULL)
+    return;
 
-  // check for buffer overrun
-  if(p == NULL)
+  if(ReadPacket())
+    m_cond.Signal();
+}
+
+void cLiveQueue::AddCredit(uint32_t packets, uint32_t bytes)
+{
+  cMutexLock lock(&m_lock);
+
+  m_creditPackets = (packets > MAX_CREDIT_PACKETS - m_creditPackets) ? MAX_CREDIT_PACKETS : m_creditPackets + packets;
+  m_creditBytes = (bytes > MAX_CREDIT_BYTES - m_creditBytes) ? MAX_CREDIT_BYTES : m_creditBytes + bytes;
+
+  m_cond.Signal();
+}
+
+void cLiveQueue::Notify()
+{
+  cMutexLock lock(&m_lock);
+
+  // wake up the sender if the client is waiting for new packets
+  if(!m_pause && HasCredit())
+    m_cond.Signal();
+}
+
+bool cLiveQueue::HasCredit()
+{
+  return (m_creditPackets > 0 || m_creditBytes > 0);
+}
+
+void cLiveQueue::UseCredit(MsgPacket* p)
+{
+  // packet credit first, byte credit for the rest
+  if(m_creditPackets > 0)
   {
-    // ring-buffer overrun ?
-    off_t pos = lseek(m_readfd, 0, SEEK_CUR);
-    if(pos < (off_t)BufferSize)
-      return;
+    m_creditPackets--;
+    return;
+  }
+
+  uint32_t length = p->getPacketLength();
+  m_creditBytes = (m_creditBytes > length) ? m_creditBytes - length : 0;
+}
 
-    lseek(m_readfd, 0, SEEK_SET);
-    p = MsgPacket::read(m_readfd, 1000);
+bool cLiveQueue::ReadPacket()
+{
+  // trick play: jump to the next I-Frame
+  if(m_speed != 1 && m_readts != DVD_NOPTS_VALUE)
+  {
+    uint64_t pos;
+    int64_t ts;
+
+    if(!m_buffer->Seek(m_readts + (int64_t)m_speed * TRICKPLAY_STEP, pos, ts, m_speed > 0))
+      return false;
+
+    m_readpos = pos;
   }
 
+  // read packet from storage
+  MsgPacket* p = m_buffer->Read(m_readpos);
+
   // no packet
   if(p == NULL)
-    return;
+    return false;
+
+  // position of the last video frame
+  if(GetFrameType(p) != cStreamInfo::ftUNKNOWN)
+  {
+    int64_t ts = GetTimeStamp(p);
+
+    if(ts != DVD_NOPTS_VALUE)
+      m_readts = ts;
+  }
 
   // put packet into queue
-  push(p);
+  PushPacket(p);
 
-  m_cond.Signal();
+  return true;
+}
+
+bool cLiveQueue::Seek(int64_t ts, bool relative, int64_t& position)
+{
+  cMutexLock lock(&m_lock);
+
+  if(m_buffer == NULL)
+    return false;
+
+  if(relative)
+  {
+    if(m_readts == DVD_NOPTS_VALUE)
+      return false;
+
+    ts += m_readts;
+  }
+
+  uint64_t pos;
+
+  // last I-Frame before the requested position (or the oldest one)
+  if(!m_buffer->Seek(ts, pos, position) && !m_buffer->Seek(ts, pos, position, true))
+    return false;
+
+  // drop packets of the old position
+  while(!empty())
+    delete PopPacket();
+
+  m_readpos = pos;
+  m_readts = position;
+
+  INFOLOG("timeshift seek to %lli", position);
+  return true;
+}
+
+bool cLiveQueue::SetSpeed(int speed)
+{
+  cMutexLock lock(&m_lock);
+
+  if(m_buffer == NULL || speed == 0)
+    return false;
+
+  m_speed = speed;
+  INFOLOG("timeshift speed %i", m_speed);
+
+  return true;
+}
+
+bool cLiveQueue::GetTimeRange(int64_t& first, int64_t& last)
+{
+  cMutexLock lock(&m_lock);
+
+  if(m_buffer == NULL)
+    return false;
+
+  return m_buffer->GetTimeRange(first, last);
 }
 
 bool cLiveQueue::IsPaused()
@@ -95,44 +354,42 @@ bool cLiveQueue::IsPaused()
 bool cLiveQueue::TimeShiftMode()
 {
   cMutexLock lock(&m_lock);
-  return (m_pause || (!m_pause && m_writefd != -1));
+  return (m_buffer != NULL);
 }
 
 bool cLiveQueue::Add(MsgPacket* p)
 {
   cMutexLock lock(&m_lock);
 
-  // in timeshift mode ?
-  if(m_pause || (!m_pause && m_writefd != -1))
+  // in timeshift mode stream packets are read from the (shared) timeshift
+  // buffer, all other messages are sent immediately
+  if(m_buffer != NULL)
   {
-    // write packet
-    if(!p->write(m_writefd, 1000))
-    {
-      ERRORLOG("Unable to write packet into timeshift ringbuffer !");
+    PushPacket(p);
+    m_cond.Signal();
+    return true;
+  }
+
+  cStreamInfo::FrameType type = GetFrameType(p);
+
+  // skip video frames until the next I-Frame
+  if(m_skipFrames && type != cStreamInfo::ftUNKNOWN)
+  {
+    if(type != cStreamInfo::ftIFRAME || IsOverloaded()) {
       delete p;
       return false;
     }
 
-    // ring-buffer overrun ?
-    off_t length = lseek(m_writefd, 0, SEEK_CUR);
-    if(length >= (off_t)BufferSize)
-    {
-      // truncate to current position
-      if(ftruncate(m_writefd, length) == 0)
-        lseek(m_writefd, 0, SEEK_SET);
-    }
-    delete p;
-    return true;
-  }
-
-  // queue too long ?
-  if (size() > 100) {
-    delete p;
-    return false;
+    m_skipFrames = false;
   }
 
   // add packet to queue
-  push(p);
+  PushPacket(p);
+
+  // client can't keep up ?
+  if(IsOverloaded())
+    DropFrames();
+
   m_cond.Signal();
 
   return true;
@@ -147,7 +404,8 @@ void cLiveQueue::Action()
 
   while(Running())
   {
-    MsgPacket* p = NULL;
+    MsgPacket* packets[64];
+    int count = 0;
 
     m_lock.Lock();
 
@@ -159,89 +417,132 @@ void cLiveQueue::Action()
       m_lock.Lock();
     }
 
-    // check packet queue
-    if(size() > 0)
+    // stream from the timeshift buffer as long as the client has credit
+    while(!m_pause && m_buffer != NULL && HasCredit() && size() < 64)
     {
-      p = front();
-      pop();
+      if(!ReadPacket())
+        break;
+
+      UseCredit(back());
     }
 
+    // take all pending packets from the queue
+    while(size() > 0 && count < 64)
+      packets[count++] = PopPacket();
+
     m_lock.Unlock();
 
     // no packets to send
-    if(p == NULL)
+    if(count == 0)
     {
       m_cond.Wait(3000);
       continue;
     }
-    // send packet
-    else {
-      p->write(m_socket, 500);
-      delete p;
-    }
 
+    // send packets with a single (scatter / gather) write
+    int written = MsgPacket::write(m_socket, packets, count, 500);
+
+    for(int i = 0; i < count; i++)
+      delete packets[i];
+
+    // a partially written packet breaks the framing of the stream
+    if(written < count)
+    {
+      ERRORLOG("failed to send %i of %i packets, closing connection", count - written, count);
+      shutdown(m_socket, SHUT_RDWR);
+      break;
+    }
   }
 
   INFOLOG("LiveQueue stopped");
 }
 
-void cLiveQueue::CloseTimeShift()
+bool cLiveQueue::Pause(bool on)
 {
-  close(m_readfd);
-  m_readfd = -1;
-  close(m_writefd);
-  m_writefd = -1;
+  cMutexLock lock(&m_lock);
 
-  unlink(m_storage);
+  // pausing needs a timeshift buffer
+  if(m_buffer == NULL || m_pause == on)
+    return false;
+
+  m_pause = on;
+  m_cond.Signal();
+
+  return true;
 }
 
-bool cLiveQueue::Pause(bool on)
+bool cLiveQueue::StartTimeShift(cTimeShiftBuffer* buffer, bool created)
 {
   cMutexLock lock(&m_lock);
 
-  // deactivate timeshift
-  if(!on)
+  if(m_buffer != NULL)
+    return false;
+
+  buffer->ref();
+
+  m_buffer = buffer;
+  m_pause = true;
+
+  // new buffer: push all packets from the queue to the buffer
+  if(created)
   {
-    m_pause = false;
-    m_cond.Signal();
+    DEBUGLOG("Writing %i packets into timeshift buffer", size());
+    m_readpos = m_buffer->GetTail();
+
+    while(!empty())
+    {
+      MsgPacket* p = PopPacket();
+
+      m_buffer->Append(p, GetFrameType(p) == cStreamInfo::ftIFRAME, GetTimeStamp(p));
+    }
+
     return true;
   }
 
-  if(m_pause)
-    return false;
+  // shared buffer: the queued stream packets are already stored,
+  // continue reading at the next I-Frame
+  int64_t ts = DVD_NOPTS_VALUE;
+  int64_t iframets = DVD_NOPTS_VALUE;
 
-  // create offline storage
-  if(m_readfd == -1)
+  for(iterator i = begin(); i != end();)
   {
-    m_storage = cString::sprintf("%s/xvdr-ringbuffer-%05i.data", (const char*)TimeShiftDir, m_socket);
-    DEBUGLOG("FILE: %s", (const char*)m_storage);
+    uint16_t msgid = (*i)->getMsgID();
 
-    m_readfd = open(m_storage, O_CREAT | O_RDONLY, 0644);
-    m_writefd = open(m_storage, O_CREAT | O_WRONLY, 0644);
-    lseek(m_readfd, 0, SEEK_SET);
-    lseek(m_writefd, 0, SEEK_SET);
-
-    if(m_readfd == -1) {
-      ERRORLOG("Failed to create timeshift ringbuffer !");
+    if((*i)->getType() != XVDR_CHANNEL_STREAM || (msgid != XVDR_STREAM_MUXPKT && msgid != XVDR_STREAM_CHANGE)) {
+      i++;
+      continue;
     }
+
+    if(ts == DVD_NOPTS_VALUE)
+      ts = GetTimeStamp(*i);
+
+    i = DropPacket(i);
   }
 
-  m_pause = true;
+  if(ts == DVD_NOPTS_VALUE || !m_buffer->Seek(ts, m_readpos, iframets, true))
+    m_readpos = m_buffer->GetHead();
 
-  // push all packets from the queue to the offline storage
-  DEBUGLOG("Writing %i packets into timeshift buffer", size());
+  m_readts = ts;
 
-  while(!empty())
-  {
-    MsgPacket* p = front();
+  return true;
+}
+
+cTimeShiftBuffer* cLiveQueue::CreateTimeShiftBuffer()
+{
+  uint32_t id = __sync_fetch_and_add(&BufferCount, 1);
+
+  cString storage = cString::sprintf("%s/xvdr-ringbuffer-%05u.data", (const char*)TimeShiftDir, id);
+  DEBUGLOG("FILE: %s", (const char*)storage);
 
-    p->write(m_writefd, 1000);
-    delete p;
+  cTimeShiftBuffer* buffer = new cTimeShiftBuffer(storage, BufferSize, RamTime);
 
-    pop();
+  if(!buffer->IsValid()) {
+    buffer->unref();
+    return NULL;
   }
 
-  return true;
+  buffer->Start();
+  return buffer;
 }
 
 void cLiveQueue::SetTimeShiftDir(const cString& dir)
@@ -256,6 +557,29 @@ void cLiveQueue::SetBufferSize(uint64_t s)
   DEBUGLOG("BUFFSERIZE: %llu bytes", BufferSize);
 }
 
+void cLiveQueue::SetQueueSize(uint64_t s)
+{
+  QueueSize = s;
+  DEBUGLOG("QUEUESIZE: %llu bytes", QueueSize);
+}
+
+void cLiveQueue::SetRamTime(uint32_t s)
+{
+  RamTime = s;
+  DEBUGLOG("TIMESHIFTRAMTIME: %u seconds", RamTime);
+}
+
+uint32_t cLiveQueue::GetRamTime()
+{
+  return RamTime;
+}
+
+void cLiveQueue::SetQueueDelay(uint32_t ms)
+{
+  QueueDelay = ms;
+  DEBUGLOG("QUEUEDELAY: %u ms", QueueDelay);
+}
+
 void cLiveQueue::RemoveTimeShiftFiles()
 {
   DIR* dir = opendir((const char*)TimeShiftDir);
@@ -25,12 +25,15 @@
 #ifndef XVDR_LIVEQUEUE_H
 #define XVDR_LIVEQUEUE_H
 
-#include <queue>
+#include <deque>
 #include <vdr/thread.h>
 
+#include "demuxer/streaminfo.h"
+
 class MsgPacket;
+class cTimeShiftBuffer;
 
-class cLiveQueue : public cThread, protected std::queue<MsgPacket*>
+class cLiveQueue : public cThread, protected std::deque<MsgPacket*>
 {
 public:
 
@@ -42,43 +45,103 @@ public:
 
   void Request();
 
+  void AddCredit(uint32_t packets, uint32_t bytes);
+
+  void Notify();
+
   bool Pause(bool on = true);
 
+  bool StartTimeShift(cTimeShiftBuffer* buffer, bool created);
+
   bool IsPaused();
 
   bool TimeShiftMode();
 
+  bool Seek(int64_t ts, bool relative, int64_t& position);
+
+  bool SetSpeed(int speed);
+
+  bool GetTimeRange(int64_t& first, int64_t& last);
+
   static void SetTimeShiftDir(const cString& dir);
 
   static void SetBufferSize(uint64_t s);
 
+  static void SetQueueSize(uint64_t s);
+
+  static void SetQueueDelay(uint32_t ms);
+
+  static void SetRamTime(uint32_t s);
+
+  static uint32_t GetRamTime();
+
   static void RemoveTimeShiftFiles();
 
+  static cTimeShiftBuffer* CreateTimeShiftBuffer();
+
 protected:
 
   void Action();
 
   void Cleanup();
 
-  void CloseTimeShift();
+  bool ReadPacket();
+
+  bool HasCredit();
+
+  void UseCredit(MsgPacket* p);
+
+  void PushPacket(MsgPacket* p);
+
+  MsgPacket* PopPacket();
+
+  iterator DropPacket(iterator i);
+
+  void DropFrames();
+
+  bool IsOverloaded();
+
+  uint32_t GetDelay();
+
+  static cStreamInfo::FrameType GetFrameType(MsgPacket* p);
+
+  static int64_t GetTimeStamp(MsgPacket* p);
 
   int m_socket;
 
-  int m_readfd;
+  cTimeShiftBuffer* m_buffer;
+
+  uint64_t m_readpos;
+
+  int64_t m_readts;
+
+  int m_speed;
 
-  int m_writefd;
+  uint32_t m_creditPackets;
+
+  uint64_t m_creditBytes;
 
   bool m_pause;
 
+  uint64_t m_bytes;
+
+  bool m_skipFrames;
+
   cMutex m_lock;
 
   cCondWait m_cond;
 
-  cString m_storage;
-
   static cString TimeShiftDir;
 
   static uint64_t BufferSize;
+
+  static uint64_t QueueSize;
+
+  static uint32_t QueueDelay;
+
+  static uint32_t BufferCount;
+
+  static uint32_t RamTime;
 };
 
 #endif // XVDR_LIVEQUEUE_H
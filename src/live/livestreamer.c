@@ -43,32 +43,35 @@
 #include "net/msgpacket.h"
 #include "xvdr/xvdrcommand.h"
 #include "tools/hash.h"
+#include "tools/tssync.h"
 
 #include "livestreamer.h"
 #include "livepatfilter.h"
 #include "livequeue.h"
+#include "liveclient.h"
+#include "timeshiftbuffer.h"
 #include "channelcache.h"
 
-cLiveStreamer::cLiveStreamer(int priority, uint32_t timeout, uint32_t protocolVersion)
+std::map<uint32_t, cLiveStreamer*> cLiveStreamer::m_Streamers;
+cMutex cLiveStreamer::m_StreamersLock;
+
+cLiveStreamer::cLiveStreamer(int priority, uint32_t timeout)
  : cThread("cLiveStreamer stream processor")
  , cRingBufferLinear(MEGABYTE(10), TS_SIZE * 2, true)
  , cReceiver(NULL, priority)
  , m_scanTimeout(timeout)
 {
   m_Device          = NULL;
-  m_Queue           = NULL;
   m_PatFilter       = NULL;
   m_startup         = true;
   m_SignalLost      = false;
-  m_LangStreamType  = cStreamInfo::stMPEG2AUDIO;
-  m_LanguageIndex   = -1;
   m_uid             = 0;
   m_ready           = false;
-  m_protocolVersion = protocolVersion;
-  m_waitforiframe   = false;
 
   m_requestStreamChange = false;
 
+  m_PidMap = new cTSDemuxer*[MAXPID];
+  memset(m_PidMap, 0, MAXPID * sizeof(cTSDemuxer*));
 
   if(m_scanTimeout == 0)
     m_scanTimeout = XVDRServerConfig.stream_timeout;
@@ -102,7 +105,10 @@ cLiveStreamer::~cLiveStreamer()
   }
   m_Demuxers.clear();
 
-  delete m_Queue;
+  delete[] m_PidMap;
+
+  for (std::list<sTimeShift>::iterator i = m_TimeShifts.begin(); i != m_TimeShifts.end(); i++)
+    i->buffer->unref();
 
   DEBUGLOG("Finished to delete live streamer (took %llu ms)", t.Elapsed());
 }
@@ -146,17 +152,19 @@ void cLiveStreamer::Action(void)
       continue;
 
     // Sync to TS packet
-    int used = 0;
-    while (size > TS_SIZE)
-    {
-      if (buf[0] == TS_SYNC_BYTE && buf[TS_SIZE] == TS_SYNC_BYTE)
-        break;
-      used++;
-      buf++;
-      size--;
-    }
-    Del(used);
+    int used = TsFindSync(buf, size);
+
+    // no sync found, keep the last packet for the next run
+    if (used < 0)
+      used = size - TS_SIZE;
+
+    buf += used;
+    size -= used;
 
+    // demux all complete packets of the contiguous span at once, the PAT
+    // filter replaces the demuxers and reads their stream info under the
+    // same lock
+    cMutexLock lock(&m_FilterMutex);
 
     while (size >= TS_SIZE)
     {
@@ -167,38 +175,193 @@ void cLiveStreamer::Action(void)
       if (buf[0] != TS_SYNC_BYTE)
         break;
 
-      unsigned int ts_pid = TsPid(buf);
-
-      {
-        cMutexLock lock(&m_FilterMutex);
-        cTSDemuxer *demuxer = FindStreamDemuxer(ts_pid);
+      cTSDemuxer *demuxer = FindStreamDemuxer(TsPid(buf));
 
-        if (demuxer)
-          demuxer->ProcessTSPacket(buf);
-      }
+      if (demuxer)
+        demuxer->ProcessTSPacket(buf);
 
       buf += TS_SIZE;
       size -= TS_SIZE;
-      Del(TS_SIZE);
+      used += TS_SIZE;
     }
+
+    // release the processed span at once
+    Del(used);
   }
 }
 
-int cLiveStreamer::StreamChannel(const cChannel *channel, int sock, bool waitforiframe)
+cLiveStreamer* cLiveStreamer::Subscribe(cLiveClient* client, const cChannel *channel, int priority, uint32_t timeout, int& status)
 {
   if (channel == NULL)
   {
     ERRORLOG("Starting streaming of channel without valid channel");
-    return XVDR_RET_ERROR;
+    status = XVDR_RET_ERROR;
+    return NULL;
   }
 
-  m_uid = CreateChannelUID(channel);
-  m_waitforiframe = waitforiframe;
+  uint32_t uid = CreateChannelUID(channel);
+  cMutexLock lock(&m_StreamersLock);
+
+  // join the running stream of the channel
+  std::map<uint32_t, cLiveStreamer*>::iterator i = m_Streamers.find(uid);
+  if (i != m_Streamers.end() && i->second->Active() && i->second->IsAttached())
+  {
+    INFOLOG("Joining running stream of channel %i - %s", channel->Number(), channel->Name());
+    i->second->AddClient(client);
+    status = XVDR_RET_OK;
+    return i->second;
+  }
+
+  // start a new one
+  cLiveStreamer* streamer = new cLiveStreamer(priority, timeout);
+  streamer->AddClient(client);
+
+  status = streamer->StreamChannel(channel);
 
-  if(m_waitforiframe) {
-    INFOLOG("Will wait for first I-Frame ...");
+  if (status != XVDR_RET_OK)
+  {
+    delete streamer;
+    return NULL;
+  }
+
+  // a stale (detached) streamer is left to its remaining clients
+  m_Streamers[uid] = streamer;
+  return streamer;
+}
+
+void cLiveStreamer::Unsubscribe(cLiveClient* client, cLiveStreamer* streamer)
+{
+  if (streamer == NULL)
+    return;
+
+  {
+    cMutexLock lock(&m_StreamersLock);
+
+    // streamer still in use ?
+    if (!streamer->RemoveClient(client))
+      return;
+
+    std::map<uint32_t, cLiveStreamer*>::iterator i = m_Streamers.find(streamer->m_uid);
+    if (i != m_Streamers.end() && i->second == streamer)
+      m_Streamers.erase(i);
   }
 
+  // no client left, nobody else can reach the streamer
+  delete streamer;
+}
+
+void cLiveStreamer::AddClient(cLiveClient* client)
+{
+  cMutexLock lock(&m_ClientsLock);
+  m_Clients.push_back(client);
+  INFOLOG("%zu client(s) attached to channel stream", m_Clients.size());
+
+  // record in the background for instant pause / rewind
+  if (cLiveQueue::GetRamTime() > 0)
+    AttachTimeShift(client);
+}
+
+bool cLiveStreamer::RemoveClient(cLiveClient* client)
+{
+  cMutexLock lock(&m_ClientsLock);
+  StopTimeShift(client);
+  m_Clients.remove(client);
+  return m_Clients.empty();
+}
+
+bool cLiveStreamer::AttachTimeShift(cLiveClient* client, bool* created)
+{
+  cMutexLock lock(&m_ClientsLock);
+
+  if (client->m_TimeShift != NULL)
+    return true;
+
+  // clients with the same stream setup share a buffer
+  std::list<sTimeShift>::iterator i = m_TimeShifts.begin();
+  for (; i != m_TimeShifts.end(); i++) {
+    if (i->lang == client->m_LanguageIndex && i->type == client->m_LangStreamType && i->protocolVersion == client->m_protocolVersion)
+      break;
+  }
+
+  if (created != NULL)
+    *created = false;
+
+  if (i == m_TimeShifts.end())
+  {
+    sTimeShift t;
+    t.buffer = cLiveQueue::CreateTimeShiftBuffer();
+
+    if (t.buffer == NULL)
+      return false;
+
+    t.clients = 0;
+    t.lang = client->m_LanguageIndex;
+    t.type = client->m_LangStreamType;
+    t.protocolVersion = client->m_protocolVersion;
+
+    i = m_TimeShifts.insert(m_TimeShifts.end(), t);
+
+    if (created != NULL)
+      *created = true;
+  }
+
+  i->clients++;
+  client->m_TimeShift = i->buffer;
+
+  INFOLOG("%i client(s) attached to timeshift buffer", i->clients);
+  return true;
+}
+
+bool cLiveStreamer::StartTimeShift(cLiveClient* client)
+{
+  cMutexLock lock(&m_ClientsLock);
+
+  if (client->m_TimeShiftMode)
+    return false;
+
+  bool created = false;
+
+  if (!AttachTimeShift(client, &created))
+    return false;
+
+  if (!client->m_Queue->StartTimeShift(client->m_TimeShift, created))
+    return false;
+
+  client->m_TimeShiftMode = true;
+  return true;
+}
+
+void cLiveStreamer::StopTimeShift(cLiveClient* client)
+{
+  cMutexLock lock(&m_ClientsLock);
+
+  if (client->m_TimeShift == NULL)
+    return;
+
+  for (std::list<sTimeShift>::iterator i = m_TimeShifts.begin(); i != m_TimeShifts.end(); i++)
+  {
+    if (i->buffer != client->m_TimeShift)
+      continue;
+
+    // last reader gone, stop writing the buffer
+    if (--i->clients == 0)
+    {
+      INFOLOG("Closing timeshift buffer");
+      i->buffer->unref();
+      m_TimeShifts.erase(i);
+    }
+
+    break;
+  }
+
+  client->m_TimeShift = NULL;
+  client->m_TimeShiftMode = false;
+}
+
+int cLiveStreamer::StreamChannel(const cChannel *channel)
+{
+  m_uid = CreateChannelUID(channel);
+
   // check if any device is able to decrypt the channel - code taken from VDR
   int NumUsableSlots = 0;
 
@@ -248,13 +411,6 @@ int cLiveStreamer::StreamChannel(const cChannel *channel, int sock, bool waitfor
     return XVDR_RET_ERROR;
   }
 
-  // create send queue
-  if (m_Queue == NULL)
-  {
-    m_Queue = new cLiveQueue(sock);
-    m_Queue->Start();
-  }
-
   m_PatFilter = new cLivePatFilter(this, channel);
 
   // get cached demuxer data
@@ -295,13 +451,11 @@ int cLiveStreamer::StreamChannel(const cChannel *channel, int sock, bool waitfor
   return XVDR_RET_OK;
 }
 
-cTSDemuxer *cLiveStreamer::FindStreamDemuxer(int Pid)
+void cLiveStreamer::SetPidMap(cTSDemuxer** map)
 {
-  for (std::list<cTSDemuxer*>::iterator i = m_Demuxers.begin(); i != m_Demuxers.end(); i++)
-    if ((*i) != NULL && (*i)->GetPID() == Pid)
-      return (*i);
-
-  return NULL;
+  // called with m_FilterMutex held
+  delete[] m_PidMap;
+  m_PidMap = map;
 }
 
 bool cLiveStreamer::Attach(void)
@@ -327,24 +481,14 @@ void cLiveStreamer::sendStreamPacket(sStreamPacket *pkt)
   if(!bReady || pkt == NULL || pkt->size == 0)
     return;
 
-  // Send stream information as the first packet on startup
-  if (IsStarting() && bReady)
+  if (IsStarting())
   {
-    // wait for first I-Frame (if enabled)
-    if(m_waitforiframe && pkt->frametype != cStreamInfo::ftIFRAME) {
-      return;
-    }
-
     INFOLOG("streaming of channel started");
     m_last_tick.Set(0);
     m_requestStreamChange = true;
     m_startup = false;
   }
 
-  // send stream change on demand
-  if(m_requestStreamChange)
-    sendStreamChange();
-
   // if a audio or video packet was sent, the signal is restored
   if(m_SignalLost && (pkt->content == cStreamInfo::scVIDEO || pkt->content == cStreamInfo::scAUDIO)) {
     INFOLOG("signal restored");
@@ -358,40 +502,58 @@ void cLiveStreamer::sendStreamPacket(sStreamPacket *pkt)
   if(m_SignalLost)
     return;
 
-  // initialise stream packet
-  MsgPacket* packet = new MsgPacket(XVDR_STREAM_MUXPKT, XVDR_CHANNEL_STREAM);
-  packet->disablePayloadCheckSum();
+  // copy the payload once and share it between all clients
+  MsgPayload* payload = MsgPayload::create(pkt->data, pkt->size);
+
+  if(payload == NULL)
+    return;
+
+  // fan out the packet to all clients
+  cMutexLock lock(&m_ClientsLock);
 
-  // write stream data
-  packet->put_U16(pkt->pid);
-  packet->put_S64(pkt->pts);
-  packet->put_S64(pkt->dts);
-  if(m_protocolVersion >= 5) {
-    packet->put_U32(pkt->duration);
+  bool streamChange = m_requestStreamChange;
+  m_requestStreamChange = false;
+
+  // write the packet once into every timeshift buffer of the channel
+  int64_t ts = (pkt->dts != DVD_NOPTS_VALUE) ? pkt->dts : pkt->pts;
+
+  for (std::list<sTimeShift>::iterator i = m_TimeShifts.begin(); i != m_TimeShifts.end(); i++)
+  {
+    if(streamChange)
+      i->buffer->Append(CreateStreamChange(i->lang, i->type, i->protocolVersion), false, DVD_NOPTS_VALUE);
+
+    MsgPacket* packet = cLiveClient::CreateStreamPacket(pkt, payload, i->protocolVersion);
+
+    if(!i->buffer->Append(packet, pkt->frametype == cStreamInfo::ftIFRAME, ts))
+      ERRORLOG("Unable to write packet into timeshift ringbuffer !");
   }
 
-  // write frame type into unused header field clientid
-  packet->setClientID((uint16_t)pkt->frametype);
+  for (std::list<cLiveClient*>::iterator i = m_Clients.begin(); i != m_Clients.end(); i++) {
+    if(streamChange)
+      (*i)->RequestStreamChange();
+
+    (*i)->sendStreamPacket(pkt, payload);
+  }
 
-  // write payload into stream packet
-  packet->put_U32(pkt->size);
-  packet->put_Blob(pkt->data, pkt->size);
+  payload->unref();
 
-  m_Queue->Add(packet);
   m_last_tick.Set(0);
 }
 
 void cLiveStreamer::sendDetach() {
-  INFOLOG("sending detach message");
-  MsgPacket* resp = new MsgPacket(XVDR_STREAM_DETACH, XVDR_CHANNEL_STREAM);
-  m_Queue->Add(resp);
+  cMutexLock lock(&m_ClientsLock);
+
+  for (std::list<cLiveClient*>::iterator i = m_Clients.begin(); i != m_Clients.end(); i++)
+    (*i)->sendDetach();
 }
 
-void cLiveStreamer::sendStreamChange()
+MsgPacket* cLiveStreamer::CreateStreamChange(int lang, cStreamInfo::Type type, uint32_t protocolVersion)
 {
   MsgPacket* resp = new MsgPacket(XVDR_STREAM_CHANGE, XVDR_CHANNEL_STREAM);
 
-  DEBUGLOG("sendStreamChange");
+  DEBUGLOG("CreateStreamChange");
+
+  m_FilterMutex.Lock();
 
   cChannelCache cache;
   INFOLOG("Stored channel information in cache:");
@@ -401,10 +563,8 @@ void cLiveStreamer::sendStreamChange()
   }
   cChannelCache::AddToCache(m_uid, cache);
 
-  m_FilterMutex.Lock();
-
   // reorder streams as preferred
-  reorderStreams(m_LanguageIndex, m_LangStreamType);
+  reorderStreams(lang, type);
 
   for (std::list<cTSDemuxer*>::iterator idx = m_Demuxers.begin(); idx != m_Demuxers.end(); idx++)
   {
@@ -421,7 +581,7 @@ void cLiveStreamer::sendStreamChange()
       case cStreamInfo::scAUDIO:
         resp->put_String(stream->TypeName());
         resp->put_String(stream->GetLanguage());
-        if(m_protocolVersion >= 5) {
+        if(protocolVersion >= 5) {
           resp->put_U32(stream->GetChannels());
           resp->put_U32(stream->GetSampleRate());
           resp->put_U32(stream->GetBlockAlign());
@@ -457,93 +617,15 @@ void cLiveStreamer::sendStreamChange()
 
   m_FilterMutex.Unlock();
 
-  m_Queue->Add(resp);
-  m_requestStreamChange = false;
+  return resp;
 }
 
 void cLiveStreamer::sendStatus(int status)
 {
-  MsgPacket* packet = new MsgPacket(XVDR_STREAM_STATUS, XVDR_CHANNEL_STREAM);
-  packet->put_U32(status);
-  m_Queue->Add(packet);
-}
-
-void cLiveStreamer::RequestSignalInfo()
-{
-  // do not send (and pollute the client with) signal information
-  // if we are paused
-  if(IsPaused())
-    return;
-
-  MsgPacket* resp = new MsgPacket(XVDR_STREAM_SIGNALINFO, XVDR_CHANNEL_STREAM);
+  cMutexLock lock(&m_ClientsLock);
 
-  int DeviceNumber = m_Device->DeviceNumber() + 1;
-  int Strength = 0;
-  int Quality = 0;
-
-  if(!TimeShiftMode()) {
-    Strength = m_Device->SignalStrength();
-    Quality = m_Device->SignalQuality();
-  }
-
-  resp->put_String(*cString::sprintf("%s #%d - %s", 
-#if VDRVERSNUM < 10728
-#warning "VDR versions < 1.7.28 do not support all features"
-			"Unknown",
-			DeviceNumber,
-			"Unknown"));
-#else
-			(const char*)m_Device->DeviceType(),
-			DeviceNumber,
-			(const char*)m_Device->DeviceName()));
-#endif
-
-  // Quality:
-  // 4 - NO LOCK
-  // 3 - NO SYNC
-  // 2 - NO VITERBI
-  // 1 - NO CARRIER
-  // 0 - NO SIGNAL
-
-  if(TimeShiftMode())
-  {
-    resp->put_String("TIMESHIFT");
-  }
-  else if(Quality == -1)
-  {
-    resp->put_String("UNKNOWN (Incompatible device)");
-    Quality = 0;
-  }
-  else
-    resp->put_String(*cString::sprintf("%s:%s:%s:%s:%s", 
-			(Quality > 4) ? "LOCKED" : "-",
-			(Quality > 0) ? "SIGNAL" : "-",
-			(Quality > 1) ? "CARRIER" : "-",
-			(Quality > 2) ? "VITERBI" : "-",
-			(Quality > 3) ? "SYNC" : "-"));
-
-  resp->put_U32((Strength << 16 ) / 100);
-  resp->put_U32((Quality << 16 ) / 100);
-  resp->put_U32(0);
-  resp->put_U32(0);
-
-  // get provider & service information
-  const cChannel* channel = FindChannelByUID(m_uid);
-  if(channel != NULL) {
-    // put in provider name
-    resp->put_String(channel->Provider());
-
-    // what the heck should be the service name ?
-    // using PortalName for now
-    resp->put_String(channel->PortalName());
-  }
-  else {
-    resp->put_String("");
-    resp->put_String("");
-  }
-
-  DEBUGLOG("RequestSignalInfo");
-  m_Queue->Add(resp);
+  for (std::list<cLiveClient*>::iterator i = m_Clients.begin(); i != m_Clients.end(); i++)
+    (*i)->sendStatus(status);
 }
 
 void cLiveStreamer::reorderStreams(int lang, cStreamInfo::Type type)
@@ -623,20 +705,12 @@ void cLiveStreamer::reorderStreams(int lang, cStreamInfo::Type type)
   }
 }
 
-void cLiveStreamer::SetLanguage(int lang, cStreamInfo::Type streamtype)
-{
-  if(lang == -1)
-    return;
-
-  m_LanguageIndex = lang;
-  m_LangStreamType = streamtype;
-}
-
 bool cLiveStreamer::IsReady()
 {
   if(m_ready)
     return true;
 
+  // called by the demuxers with m_FilterMutex held
   bool bAllParsed = true;
 
   for (std::list<cTSDemuxer*>::iterator i = m_Demuxers.begin(); i != m_Demuxers.end(); i++)
@@ -657,37 +731,6 @@ bool cLiveStreamer::IsReady()
   return bAllParsed;
 }
 
-bool cLiveStreamer::IsPaused()
-{
-  if(m_Queue == NULL)
-    return false;
-
-  return m_Queue->IsPaused();
-}
-
-bool cLiveStreamer::TimeShiftMode()
-{
-  if(m_Queue == NULL)
-    return false;
-
-  return m_Queue->TimeShiftMode();
-}
-
-void cLiveStreamer::Pause(bool on) {
-  if(m_Queue == NULL)
-    return;
-
-  m_Queue->Pause(on);
-}
-
-void cLiveStreamer::RequestPacket()
-{
-  if(m_Queue == NULL)
-    return;
-
-  m_Queue->Request();
-}
-
 void cLiveStreamer::Receive(uchar *Data, int Length)
 {
   int p = Put(Data, Length);
@@ -31,17 +31,20 @@
 #include <vdr/receiver.h>
 #include <vdr/thread.h>
 #include <vdr/ringbuffer.h>
+#include <vdr/remux.h>
 
 #include "demuxer/demuxer.h"
 #include "xvdr/xvdrcommand.h"
 
 #include <list>
+#include <map>
 
 class cChannel;
 class cTSDemuxer;
 class MsgPacket;
 class cLivePatFilter;
-class cLiveQueue;
+class cLiveClient;
+class cTimeShiftBuffer;
 
 class cLiveStreamer : public cThread
                     , public cRingBufferLinear
@@ -51,34 +54,60 @@ private:
   friend class cTSDemuxer;
   friend class cLivePatFilter;
   friend class cChannelCache;
+  friend class cLiveClient;
+
+  cLiveStreamer(int priority, uint32_t timeout = 0);
+  virtual ~cLiveStreamer();
+
+  int StreamChannel(const cChannel *channel);
 
   void Detach(void);
   bool Attach(void);
-  cTSDemuxer *FindStreamDemuxer(int Pid);
+  cTSDemuxer *FindStreamDemuxer(int Pid) { return m_PidMap[Pid & (MAXPID - 1)]; }
+  void SetPidMap(cTSDemuxer** map);
+
+  void AddClient(cLiveClient* client);
+  bool RemoveClient(cLiveClient* client);
+
+  bool AttachTimeShift(cLiveClient* client, bool* created = NULL);
+  bool StartTimeShift(cLiveClient* client);
+  void StopTimeShift(cLiveClient* client);
 
   void reorderStreams(int lang, cStreamInfo::Type type);
+  MsgPacket* CreateStreamChange(int lang, cStreamInfo::Type type, uint32_t protocolVersion);
 
   void sendStreamPacket(sStreamPacket *pkt);
-  void sendStreamChange();
   void sendStatus(int status);
   void sendDetach();
 
   cDevice          *m_Device;                       /*!> The receiving device the channel depents to */
   cLivePatFilter   *m_PatFilter;                    /*!> Filter processor to get changed pid's */
   std::list<cTSDemuxer*> m_Demuxers;
+  cTSDemuxer**      m_PidMap;                       /*!> PID to demuxer lookup table (MAXPID entries), guarded by m_FilterMutex */
+  std::list<cLiveClient*> m_Clients;                /*!> Clients receiving the stream of this channel */
+
+  struct sTimeShift
+  {
+    cTimeShiftBuffer *buffer;
+    int               clients;
+    int               lang;
+    cStreamInfo::Type type;
+    uint32_t          protocolVersion;
+  };
+
+  std::list<sTimeShift> m_TimeShifts;               /*!> Timeshift buffers written for the clients of this channel */
+  cMutex            m_ClientsLock;
   bool              m_startup;
   bool              m_requestStreamChange;
   uint32_t          m_scanTimeout;                  /*!> Channel scanning timeout (in seconds) */
   cTimeMs           m_last_tick;
   bool              m_SignalLost;
   cMutex            m_FilterMutex;
-  int               m_LanguageIndex;
-  cStreamInfo::Type m_LangStreamType;
-  cLiveQueue*       m_Queue;
   uint32_t          m_uid;
-  bool              m_ready;
-  uint32_t          m_protocolVersion;
-  bool              m_waitforiframe;
+  volatile bool     m_ready;                        /*!> All streams parsed, written under m_FilterMutex */
+
+  static std::map<uint32_t, cLiveStreamer*> m_Streamers;  /*!> Running streamers by channel uid */
+  static cMutex     m_StreamersLock;
 
 protected:
   void Action(void);
@@ -87,20 +116,23 @@ protected:
   void RequestStreamChange();
 
 public:
-  cLiveStreamer(int priority, uint32_t timeout = 0, uint32_t protocolVersion = XVDR_PROTOCOLVERSION);
-  virtual ~cLiveStreamer();
 
-  int StreamChannel(const cChannel *channel, int sock, bool waitforiframe = false);
+  /**
+   * Attach a client to the streamer of a channel.
+   * A running streamer of the channel is shared, otherwise a new one is
+   * started. Returns the streamer or NULL if the channel can't be streamed,
+   * "status" is set to the XVDR return code.
+   */
+  static cLiveStreamer* Subscribe(cLiveClient* client, const cChannel *channel, int priority, uint32_t timeout, int& status);
+
+  /**
+   * Detach a client from its streamer.
+   * The streamer is deleted with its last client.
+   */
+  static void Unsubscribe(cLiveClient* client, cLiveStreamer* streamer);
 
   bool IsReady();
   bool IsStarting() { return m_startup; }
-  bool IsPaused();
-  bool TimeShiftMode();
-
-  void SetLanguage(int lang, cStreamInfo::Type streamtype = cStreamInfo::stAC3);
-  void Pause(bool on);
-  void RequestPacket();
-  void RequestSignalInfo();
 };
 
 #endif  // XVDR_RECEIVER_H
@@ -0,0 +1,391 @@
+/*
+ *      vdr-plugin-xvdr - XVDR server plugin for VDR
+ *
+ *      Copyright (C) 2012 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-xvdr
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+
+#ifdef __FreeBSD__
+#include <sys/endian.h>
+#else
+#include <endian.h>
+#endif
+
+#include "config/config.h"
+#include "net/msgpacket.h"
+#include "demuxer/demuxer.h"
+#include "timeshiftbuffer.h"
+
+// maximum amount of data waiting to be written to the file
+#define MAX_PENDING_SIZE (32*1024*1024)
+
+// maximum amount of written data kept in memory
+#define MAX_RAM_SIZE (64*1024*1024)
+
+// timestamp jumps beyond 10 seconds start a new timeline (microseconds)
+#define MAX_TS_JUMP (10LL*1000000)
+
+cTimeShiftBuffer::cTimeShiftBuffer(const cString& filename, uint64_t size, uint32_t ramtime) : cThread("cTimeShiftBuffer writer"), m_filename(filename), m_fd(-1), m_data(NULL), m_size(size), m_head(0), m_tail(0), m_written(0), m_ramtime(ramtime), m_ts(DVD_NOPTS_VALUE), m_refcount(1)
+{
+  m_fd = open(m_filename, O_CREAT | O_RDWR | O_TRUNC, 0644);
+
+  if(m_fd == -1) {
+    ERRORLOG("Failed to create timeshift ringbuffer %s", (const char*)m_filename);
+    return;
+  }
+
+  if(ftruncate(m_fd, m_size) != 0) {
+    ERRORLOG("Failed to allocate %llu bytes for timeshift ringbuffer", m_size);
+    return;
+  }
+
+  void* data = mmap(NULL, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+
+  if(data == MAP_FAILED) {
+    ERRORLOG("Failed to map timeshift ringbuffer (%llu bytes)", m_size);
+    return;
+  }
+
+  m_data = (uint8_t*)data;
+  madvise(m_data, m_size, MADV_SEQUENTIAL);
+}
+
+bool cTimeShiftBuffer::CompareTimeStamp(int64_t ts, const sIndexEntry& e)
+{
+  return ts < e.ts;
+}
+
+bool cTimeShiftBuffer::CompareEntry(const sIndexEntry& e, int64_t ts)
+{
+  return e.ts < ts;
+}
+
+bool cTimeShiftBuffer::CompareRamEntry(uint64_t pos, const sRamEntry& e)
+{
+  return pos < e.pos;
+}
+
+cTimeShiftBuffer::~cTimeShiftBuffer()
+{
+  m_write.Signal();
+  Cancel(3);
+
+  for(std::deque<sRamEntry>::iterator i = m_ram.begin(); i != m_ram.end(); i++)
+    delete i->packet;
+
+  if(m_data != NULL)
+    munmap(m_data, m_size);
+
+  if(m_fd != -1) {
+    close(m_fd);
+    unlink(m_filename);
+  }
+}
+
+bool cTimeShiftBuffer::IsValid()
+{
+  return (m_data != NULL);
+}
+
+void cTimeShiftBuffer::ref()
+{
+  __sync_add_and_fetch(&m_refcount, 1);
+}
+
+void cTimeShiftBuffer::unref()
+{
+  if(__sync_sub_and_fetch(&m_refcount, 1) == 0)
+    delete this;
+}
+
+uint64_t cTimeShiftBuffer::GetHead()
+{
+  cMutexLock lock(&m_lock);
+  return m_head;
+}
+
+uint64_t cTimeShiftBuffer::GetTail()
+{
+  cMutexLock lock(&m_lock);
+  return m_tail;
+}
+
+void cTimeShiftBuffer::CopyIn(uint64_t pos, MsgPacket* p, uint32_t length)
+{
+  uint64_t offset = pos % m_size;
+  uint32_t n = (offset + length > m_size) ? (uint32_t)(m_size - offset) : length;
+
+  p->copy(m_data + offset, 0, n);
+
+  // wrap around
+  if(n < length)
+    p->copy(m_data, n, length - n);
+}
+
+void cTimeShiftBuffer::CopyOut(uint64_t pos, uint8_t* data, uint32_t length)
+{
+  // packet still in memory ?
+  if(!m_ram.empty() && pos >= m_ram.front().pos)
+  {
+    std::deque<sRamEntry>::iterator i = std::upper_bound(m_ram.begin(), m_ram.end(), pos, CompareRamEntry);
+    i--;
+
+    i->packet->copy(data, (uint32_t)(pos - i->pos), length);
+    return;
+  }
+
+  uint64_t offset = pos % m_size;
+  uint32_t n = (offset + length > m_size) ? (uint32_t)(m_size - offset) : length;
+
+  memcpy(data, m_data + offset, n);
+
+  // wrap around
+  if(n < length)
+    memcpy(data + n, m_data, length - n);
+}
+
+uint32_t cTimeShiftBuffer::GetPacketLength(uint64_t pos)
+{
+  uint8_t header[MsgPacket::HeaderLength];
+  CopyOut(pos, header, sizeof(header));
+
+  uint32_t length;
+  memcpy(&length, header + MsgPacket::PayloadLengthPos, sizeof(length));
+
+  return MsgPacket::HeaderLength + be32toh(length);
+}
+
+void cTimeShiftBuffer::Evict(uint64_t length)
+{
+  // drop the oldest packets until "length" bytes are free
+  while(m_written - m_tail + length > m_size && m_tail < m_written)
+    m_tail += GetPacketLength(m_tail);
+
+  while(!m_index.empty() && m_index.front().pos < m_tail)
+    m_index.pop_front();
+}
+
+bool cTimeShiftBuffer::Append(MsgPacket* p, bool iframe, int64_t ts)
+{
+  if(!IsValid()) {
+    delete p;
+    return false;
+  }
+
+  p->freeze();
+  uint32_t length = p->getPacketLength();
+
+  if(length > m_size) {
+    delete p;
+    return false;
+  }
+
+  {
+    cMutexLock lock(&m_lock);
+
+    // writer can't keep up
+    if(m_head - m_written + length > MAX_PENDING_SIZE) {
+      delete p;
+      return false;
+    }
+
+    // PTS wrap or stream restart
+    if(ts != DVD_NOPTS_VALUE && m_ts != DVD_NOPTS_VALUE && (ts < m_ts - MAX_TS_JUMP || ts > m_ts + MAX_TS_JUMP))
+      Discontinuity();
+
+    sRamEntry r;
+    r.pos = m_head;
+    r.ts = ts;
+    r.packet = p;
+    m_ram.push_back(r);
+
+    if(ts != DVD_NOPTS_VALUE)
+      m_ts = ts;
+
+    // the index must stay sorted by timestamp
+    if(iframe && ts != DVD_NOPTS_VALUE && (m_index.empty() || ts >= m_index.back().ts)) {
+      sIndexEntry e;
+      e.pos = m_head;
+      e.ts = ts;
+      m_index.push_back(e);
+    }
+
+    m_head += length;
+  }
+
+  m_write.Signal();
+  return true;
+}
+
+void cTimeShiftBuffer::Action()
+{
+  while(Running())
+  {
+    m_write.Wait(100);
+
+    // write all pending packets
+    while(Running() && Spill());
+  }
+}
+
+bool cTimeShiftBuffer::Spill()
+{
+  MsgPacket* p = NULL;
+  uint64_t pos = 0;
+  uint32_t length = 0;
+
+  {
+    cMutexLock lock(&m_lock);
+
+    if(m_written >= m_head)
+      return false;
+
+    std::deque<sRamEntry>::iterator i = std::upper_bound(m_ram.begin(), m_ram.end(), m_written, CompareRamEntry);
+    i--;
+
+    p = i->packet;
+    pos = m_written;
+    length = p->getPacketLength();
+
+    Evict(length);
+  }
+
+  // readers never access the space behind the tail,
+  // the packet stays in memory until it has been written
+  CopyIn(pos, p, length);
+
+  cMutexLock lock(&m_lock);
+
+  m_written += length;
+  Trim();
+
+  return true;
+}
+
+void cTimeShiftBuffer::Trim()
+{
+  // keep the last "ramtime" seconds of written packets in memory
+  // (timestamps are in microseconds)
+  while(!m_ram.empty() && m_ram.front().pos < m_written)
+  {
+    sRamEntry& r = m_ram.front();
+
+    if(m_ramtime > 0 && r.ts != DVD_NOPTS_VALUE && m_ts - r.ts < (int64_t)m_ramtime * 1000000 && m_written - r.pos <= MAX_RAM_SIZE)
+      break;
+
+    delete r.packet;
+    m_ram.pop_front();
+  }
+}
+
+void cTimeShiftBuffer::Discontinuity()
+{
+  INFOLOG("timeshift: timestamp discontinuity, resetting index");
+
+  // I-Frames of the old timeline can't be found by time anymore
+  m_index.clear();
+
+  // packets of the old timeline leave the memory tier once they are written
+  for(std::deque<sRamEntry>::iterator i = m_ram.begin(); i != m_ram.end(); i++)
+    i->ts = DVD_NOPTS_VALUE;
+}
+
+MsgPacket* cTimeShiftBuffer::Read(uint64_t& pos)
+{
+  cMutexLock lock(&m_lock);
+
+  // buffer overrun -> continue with the oldest packet
+  if(pos < m_tail)
+    pos = m_tail;
+
+  if(pos >= m_head)
+    return NULL;
+
+  // the uid will be read from the header
+  MsgPacket* p = new MsgPacket(0, 0, 0, false);
+  uint32_t length = GetPacketLength(pos);
+
+  CopyOut(pos, p->getPacket(), MsgPacket::HeaderLength);
+
+  if(length > MsgPacket::HeaderLength) {
+    uint8_t* data = p->reserve(length - MsgPacket::HeaderLength);
+
+    if(data == NULL) {
+      delete p;
+      return NULL;
+    }
+
+    CopyOut(pos + MsgPacket::HeaderLength, data, length - MsgPacket::HeaderLength);
+  }
+
+  if(p->getPayloadCheckSum() == 0)
+    p->disablePayloadCheckSum();
+
+  pos += length;
+  return p;
+}
+
+bool cTimeShiftBuffer::Seek(int64_t ts, uint64_t& pos, int64_t& iframets, bool forward)
+{
+  cMutexLock lock(&m_lock);
+
+  if(m_index.empty())
+    return false;
+
+  std::deque<sIndexEntry>::iterator i;
+
+  if(forward) {
+    // first I-Frame at or after "ts"
+    i = std::lower_bound(m_index.begin(), m_index.end(), ts, CompareEntry);
+
+    if(i == m_index.end())
+      return false;
+  }
+  else {
+    // last I-Frame at or before "ts"
+    i = std::upper_bound(m_index.begin(), m_index.end(), ts, CompareTimeStamp);
+
+    if(i == m_index.begin())
+      return false;
+
+    i--;
+  }
+
+  pos = i->pos;
+  iframets = i->ts;
+  return true;
+}
+
+bool cTimeShiftBuffer::GetTimeRange(int64_t& first, int64_t& last)
+{
+  cMutexLock lock(&m_lock);
+
+  if(m_index.empty())
+    return false;
+
+  first = m_index.front().ts;
+  last = m_index.back().ts;
+  return true;
+}
@@ -0,0 +1,144 @@
+/*
+ *      vdr-plugin-xvdr - XVDR server plugin for VDR
+ *
+ *      Copyright (C) 2012 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-xvdr
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef XVDR_TIMESHIFTBUFFER_H
+#define XVDR_TIMESHIFTBUFFER_H
+
+#include <stdint.h>
+#include <deque>
+#include <vdr/thread.h>
+#include <vdr/tools.h>
+#include "demuxer/demuxer.h"
+
+class MsgPacket;
+
+/**
+ * Timeshift ring buffer.
+ * Packets are stored in a memory mapped ring file. Positions are logical
+ * byte offsets which only grow, the oldest packets are evicted if the
+ * ring is full. An index of all I-Frames (position and timestamp) allows
+ * seeking within the buffered window.
+ * The buffer is reference counted, it may be shared by all clients
+ * watching the same channel. Every client reads with its own position.
+ *
+ * Appended packets are kept in memory and written to the file by a
+ * separate thread, so appending never waits for disk I/O. Optionally the
+ * last "ramtime" seconds (at most MAX_RAM_SIZE bytes) stay in memory after
+ * they have been written.
+ */
+class cTimeShiftBuffer : public cThread
+{
+public:
+
+  cTimeShiftBuffer(const cString& filename, uint64_t size, uint32_t ramtime = 0);
+
+  virtual ~cTimeShiftBuffer();
+
+  bool IsValid();
+
+  void ref();
+
+  void unref();
+
+  /** Append a packet (iframe: packet starts an I-Frame with timestamp "ts"), the buffer takes ownership of the packet */
+  bool Append(MsgPacket* p, bool iframe = false, int64_t ts = DVD_NOPTS_VALUE);
+
+  /** Read the packet at "pos" and advance "pos" to the next packet */
+  MsgPacket* Read(uint64_t& pos);
+
+  /** Get the last I-Frame with a timestamp <= "ts" (forward: first I-Frame with a timestamp >= "ts") */
+  bool Seek(int64_t ts, uint64_t& pos, int64_t& iframets, bool forward = false);
+
+  /** Get the timestamps of the first and the last buffered I-Frame */
+  bool GetTimeRange(int64_t& first, int64_t& last);
+
+  uint64_t GetHead();
+
+  uint64_t GetTail();
+
+protected:
+
+  struct sIndexEntry {
+    uint64_t pos;
+    int64_t ts;
+  };
+
+  static bool CompareTimeStamp(int64_t ts, const sIndexEntry& e);
+
+  static bool CompareEntry(const sIndexEntry& e, int64_t ts);
+
+  struct sRamEntry {
+    uint64_t pos;
+    int64_t ts;
+    MsgPacket* packet;
+  };
+
+  static bool CompareRamEntry(uint64_t pos, const sRamEntry& e);
+
+  void Action();
+
+  bool Spill();
+
+  void Trim();
+
+  void Discontinuity();
+
+  void CopyIn(uint64_t pos, MsgPacket* p, uint32_t length);
+
+  void CopyOut(uint64_t pos, uint8_t* data, uint32_t length);
+
+  uint32_t GetPacketLength(uint64_t pos);
+
+  void Evict(uint64_t length);
+
+  cString m_filename;
+
+  int m_fd;
+
+  uint8_t* m_data;
+
+  uint64_t m_size;
+
+  uint64_t m_head;
+
+  uint64_t m_tail;
+
+  uint64_t m_written;
+
+  uint32_t m_ramtime;
+
+  int64_t m_ts;
+
+  std::deque<sIndexEntry> m_index;
+
+  std::deque<sRamEntry> m_ram;
+
+  cCondWait m_write;
+
+  cMutex m_lock;
+
+  int m_refcount;
+};
+
+#endif // XVDR_TIMESHIFTBUFFER_H
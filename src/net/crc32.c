@@ -0,0 +1,313 @@
+/*
+ *      vdr-plugin-xvdr - XVDR server plugin for VDR
+ *
+ *      Copyright (C) 2013 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-xvdr
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "crc32.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MSGCRC32_X86
+#include <immintrin.h>
+#endif
+
+#define CRC32_POLY 0xEDB88320
+
+typedef uint32_t (*Crc32Func)(uint32_t crc, const uint8_t* buf, uint32_t size);
+
+static uint32_t crc32_tab[8][256];
+
+static MsgCrc32::Engine crc32_engine = MsgCrc32::Slicing8;
+
+static void crc32_init() {
+	for(uint32_t n = 0; n < 256; n++) {
+		uint32_t crc = n;
+
+		for(int k = 0; k < 8; k++) {
+			crc = (crc & 1) ? (crc >> 1) ^ CRC32_POLY : (crc >> 1);
+		}
+
+		crc32_tab[0][n] = crc;
+	}
+
+	for(uint32_t n = 0; n < 256; n++) {
+		for(int k = 1; k < 8; k++) {
+			crc32_tab[k][n] = (crc32_tab[k - 1][n] >> 8) ^ crc32_tab[0][crc32_tab[k - 1][n] & 0xFF];
+		}
+	}
+}
+
+static uint32_t crc32_bytewise(uint32_t crc, const uint8_t* p, uint32_t size) {
+	while(size--) {
+		crc = crc32_tab[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	}
+
+	return crc;
+}
+
+// process 8 bytes per step (little endian only)
+static uint32_t crc32_slicing8(uint32_t crc, const uint8_t* p, uint32_t size) {
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+	while(size >= 8) {
+		uint32_t one;
+		uint32_t two;
+
+		memcpy(&one, p, sizeof(one));
+		memcpy(&two, p + 4, sizeof(two));
+		one ^= crc;
+
+		crc = crc32_tab[7][one & 0xFF] ^
+		      crc32_tab[6][(one >> 8) & 0xFF] ^
+		      crc32_tab[5][(one >> 16) & 0xFF] ^
+		      crc32_tab[4][one >> 24] ^
+		      crc32_tab[3][two & 0xFF] ^
+		      crc32_tab[2][(two >> 8) & 0xFF] ^
+		      crc32_tab[1][(two >> 16) & 0xFF] ^
+		      crc32_tab[0][two >> 24];
+
+		p += 8;
+		size -= 8;
+	}
+#endif
+
+	return crc32_bytewise(crc, p, size);
+}
+
+#ifdef MSGCRC32_X86
+
+// fold 64 byte blocks with carry-less multiplication and reduce the
+// remainder with a barrett reduction (see Intel's "Fast CRC Computation
+// for Generic Polynomials Using PCLMULQDQ Instruction")
+__attribute__((target("pclmul,sse2")))
+static uint32_t crc32_pclmul(uint32_t crc, const uint8_t* p, uint32_t size) {
+	if(size < 64) {
+		return crc32_slicing8(crc, p, size);
+	}
+
+	const __m128i k1k2 = _mm_set_epi64x(0x00000001c6e41596LL, 0x0000000154442bd4LL);
+	const __m128i k3k4 = _mm_set_epi64x(0x00000000ccaa009eLL, 0x00000001751997d0LL);
+	const __m128i k5 = _mm_set_epi64x(0, 0x0000000163cd6124LL);
+	const __m128i poly = _mm_set_epi64x(0x00000001f7011641LL, 0x00000001db710641LL);
+	const __m128i mask32 = _mm_set_epi32(0, 0, 0, -1);
+
+	__m128i x1 = _mm_loadu_si128((const __m128i*)(p + 0));
+	__m128i x2 = _mm_loadu_si128((const __m128i*)(p + 16));
+	__m128i x3 = _mm_loadu_si128((const __m128i*)(p + 32));
+	__m128i x4 = _mm_loadu_si128((const __m128i*)(p + 48));
+
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	p += 64;
+	size -= 64;
+
+	// fold 4 x 128 bits
+	while(size >= 64) {
+		__m128i t1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		__m128i t2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		__m128i t3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		__m128i t4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+		x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k1k2, 0x00), t1);
+		x2 = _mm_xor_si128(_mm_clmulepi64_si128(x2, k1k2, 0x00), t2);
+		x3 = _mm_xor_si128(_mm_clmulepi64_si128(x3, k1k2, 0x00), t3);
+		x4 = _mm_xor_si128(_mm_clmulepi64_si128(x4, k1k2, 0x00), t4);
+
+		x1 = _mm_xor_si128(x1, _mm_loadu_si128((const __m128i*)(p + 0)));
+		x2 = _mm_xor_si128(x2, _mm_loadu_si128((const __m128i*)(p + 16)));
+		x3 = _mm_xor_si128(x3, _mm_loadu_si128((const __m128i*)(p + 32)));
+		x4 = _mm_xor_si128(x4, _mm_loadu_si128((const __m128i*)(p + 48)));
+
+		p += 64;
+		size -= 64;
+	}
+
+	// fold into a single 128 bit value
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x00), _mm_clmulepi64_si128(x1, k3k4, 0x11)), x2);
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x00), _mm_clmulepi64_si128(x1, k3k4, 0x11)), x3);
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x00), _mm_clmulepi64_si128(x1, k3k4, 0x11)), x4);
+
+	while(size >= 16) {
+		x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x00), _mm_clmulepi64_si128(x1, k3k4, 0x11));
+		x1 = _mm_xor_si128(x1, _mm_loadu_si128((const __m128i*)p));
+
+		p += 16;
+		size -= 16;
+	}
+
+	// 128 -> 64 bits
+	x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x10), _mm_srli_si128(x1, 8));
+
+	// 64 -> 32 bits
+	x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k5, 0x00), _mm_srli_si128(x1, 4));
+
+	// barrett reduction
+	__m128i x2r = x1;
+	x1 = _mm_and_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, mask32), poly, 0x10), mask32);
+	x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, poly, 0x00), x2r);
+
+	crc = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+
+	return crc32_slicing8(crc, p, size);
+}
+
+#endif
+
+static bool crc32_pclmul_supported() {
+#ifdef MSGCRC32_X86
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse2");
+#else
+	return false;
+#endif
+}
+
+static uint32_t crc32_bitwise(uint32_t crc, const uint8_t* p, uint32_t size) {
+	while(size--) {
+		crc ^= *p++;
+
+		for(int k = 0; k < 8; k++) {
+			crc = (crc & 1) ? (crc >> 1) ^ CRC32_POLY : (crc >> 1);
+		}
+	}
+
+	return crc;
+}
+
+static bool crc32_selftest(Crc32Func func) {
+	uint8_t data[1024 + 8];
+	uint32_t seed = 1;
+
+	for(uint32_t i = 0; i < sizeof(data); i++) {
+		seed = seed * 1103515245 + 12345;
+		data[i] = seed >> 16;
+	}
+
+	// compare against the table free reference
+	// (all alignments, tail lengths and folding paths)
+	for(uint32_t offset = 0; offset < 8; offset++) {
+		for(uint32_t size = 0; size <= 1024; size += (size < 160) ? 1 : 37) {
+			uint32_t crc = offset * 0x9E3779B9;
+
+			if(func(crc, data + offset, size) != crc32_bitwise(crc, data + offset, size)) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+static Crc32Func crc32_select() {
+	crc32_init();
+
+#ifdef MSGCRC32_X86
+	if(crc32_pclmul_supported() && crc32_selftest(crc32_pclmul)) {
+		crc32_engine = MsgCrc32::Pclmul;
+		return crc32_pclmul;
+	}
+#endif
+
+	if(crc32_selftest(crc32_slicing8)) {
+		crc32_engine = MsgCrc32::Slicing8;
+		return crc32_slicing8;
+	}
+
+	crc32_engine = MsgCrc32::Bytewise;
+	return crc32_bytewise;
+}
+
+static Crc32Func crc32_func = crc32_select();
+
+uint32_t MsgCrc32::checksum(const uint8_t* buf, uint32_t size, uint32_t crc) {
+	// may be called during static initialization of other modules
+	if(crc32_func == NULL) {
+		crc32_func = crc32_select();
+	}
+
+	return crc32_func(crc ^ ~0U, buf, size) ^ ~0U;
+}
+
+uint32_t MsgCrc32::checksum(Engine engine, const uint8_t* buf, uint32_t size, uint32_t crc) {
+	if(crc32_func == NULL) {
+		crc32_func = crc32_select();
+	}
+
+	Crc32Func func = crc32_slicing8;
+
+	if(engine == Bytewise) {
+		func = crc32_bytewise;
+	}
+#ifdef MSGCRC32_X86
+	else if(engine == Pclmul && crc32_pclmul_supported()) {
+		func = crc32_pclmul;
+	}
+#endif
+
+	return func(crc ^ ~0U, buf, size) ^ ~0U;
+}
+
+bool MsgCrc32::isSupported(Engine engine) {
+	if(engine == Pclmul) {
+		return crc32_pclmul_supported();
+	}
+
+	return true;
+}
+
+bool MsgCrc32::selfTest(Engine engine) {
+	if(crc32_func == NULL) {
+		crc32_func = crc32_select();
+	}
+
+	if(engine == Bytewise) {
+		return crc32_selftest(crc32_bytewise);
+	}
+#ifdef MSGCRC32_X86
+	else if(engine == Pclmul && crc32_pclmul_supported()) {
+		return crc32_selftest(crc32_pclmul);
+	}
+#endif
+
+	return crc32_selftest(crc32_slicing8);
+}
+
+MsgCrc32::Engine MsgCrc32::getEngine() {
+	if(crc32_func == NULL) {
+		crc32_func = crc32_select();
+	}
+
+	return crc32_engine;
+}
+
+const char* MsgCrc32::getName(Engine engine) {
+	switch(engine) {
+		case Bytewise:
+			return "bytewise";
+		case Slicing8:
+			return "slicing-by-8";
+		case Pclmul:
+			return "pclmulqdq";
+	}
+
+	return "unknown";
+}
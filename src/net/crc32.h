@@ -0,0 +1,80 @@
+/** \file crc32.h
+	Header file for the MsgCrc32 class.
+	This include file defines the CRC32 engine used for packet checksums
+*/
+
+#ifndef MSGCRC32_H
+#define MSGCRC32_H
+
+#include <stdint.h>
+
+/**
+	@short CRC32 checksum engine
+
+	Computes CRC32 checksums (IEEE 802.3, reflected polynomial 0xEDB88320).
+	The fastest implementation supported by the CPU is chosen at runtime:
+	carry-less multiplication folding (PCLMULQDQ) or slicing-by-8 tables.
+	An implementation is only chosen if its results match a bitwise
+	reference calculation.
+*/
+
+class MsgCrc32 {
+public:
+
+	/**
+	Available implementations.
+	*/
+	enum Engine {
+		Bytewise = 0,		/*!< byte at a time table lookup (reference) */
+		Slicing8 = 1,		/*!< slicing-by-8 table lookup */
+		Pclmul = 2			/*!< PCLMULQDQ folding */
+	};
+
+	/**
+	Compute a CRC32 checksum.
+
+	@param	buf			pointer to data array
+	@param	size		size of array in bytes
+	@param	crc			crc of the preceding data (to continue a checksum)
+	@return 32bit crc
+	*/
+	static uint32_t checksum(const uint8_t* buf, uint32_t size, uint32_t crc = 0);
+
+	/**
+	Compute a CRC32 checksum with a specific implementation.
+	Falls back to slicing-by-8 if the implementation isn't supported.
+
+	@param	engine		implementation to use
+	@param	buf			pointer to data array
+	@param	size		size of array in bytes
+	@param	crc			crc of the preceding data (to continue a checksum)
+	@return 32bit crc
+	*/
+	static uint32_t checksum(Engine engine, const uint8_t* buf, uint32_t size, uint32_t crc = 0);
+
+	/**
+	Check if an implementation is supported by the CPU.
+	*/
+	static bool isSupported(Engine engine);
+
+	/**
+	Compare the results of an implementation with a bitwise reference
+	calculation.
+
+	@param	engine		implementation to test
+	@return true if all results match
+	*/
+	static bool selfTest(Engine engine);
+
+	/**
+	Get the implementation used by checksum().
+	*/
+	static Engine getEngine();
+
+	/**
+	Get the name of an implementation.
+	*/
+	static const char* getName(Engine engine);
+};
+
+#endif // MSGCRC32_H
@@ -12,8 +12,18 @@
 #include <iostream>
 #include <unistd.h>
 
+#ifndef WIN32
+#include <sys/uio.h>
+#endif
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
 #include "os-config.h"
 #include "msgpacket.h"
+#include "msgpool.h"
+#include "crc32.h"
 
 #define get_impl(T, f) \
 	if((m_readposition + sizeof(T)) > m_usage) { \
@@ -31,87 +41,64 @@
 	m_usage += sizeof(T); \
 	return true
 
-pthread_mutex_t MsgPacket::uidmutex = PTHREAD_MUTEX_INITIALIZER;
-
 uint32_t MsgPacket::globalUID = 1;
 
-uint32_t MsgPacket::crc32_tab[] = {
-	0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
-	0xe963a535, 0x9e6495a3, 0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
-	0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91, 0x1db71064, 0x6ab020f2,
-	0xf3b97148, 0x84be41de, 0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
-	0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec, 0x14015c4f, 0x63066cd9,
-	0xfa0f3d63, 0x8d080df5, 0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172,
-	0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b, 0x35b5a8fa, 0x42b2986c,
-	0xdbbbc9d6, 0xacbcf940, 0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
-	0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423,
-	0xcfba9599, 0xb8bda50f, 0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924,
-	0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d, 0x76dc4190, 0x01db7106,
-	0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
-	0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d,
-	0x91646c97, 0xe6635c01, 0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e,
-	0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457, 0x65b0d9c6, 0x12b7e950,
-	0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
-	0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7,
-	0xa4d1c46d, 0xd3d6f4fb, 0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0,
-	0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9, 0x5005713c, 0x270241aa,
-	0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
-	0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81,
-	0xb7bd5c3b, 0xc0ba6cad, 0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a,
-	0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683, 0xe3630b12, 0x94643b84,
-	0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
-	0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb,
-	0x196c3671, 0x6e6b06e7, 0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc,
-	0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5, 0xd6d6a3e8, 0xa1d1937e,
-	0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
-	0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55,
-	0x316e8eef, 0x4669be79, 0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236,
-	0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f, 0xc5ba3bbe, 0xb2bd0b28,
-	0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
-	0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f,
-	0x72076785, 0x05005713, 0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38,
-	0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21, 0x86d3d2d4, 0xf1d4e242,
-	0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
-	0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69,
-	0x616bffd3, 0x166ccf45, 0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2,
-	0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db, 0xaed16a4a, 0xd9d65adc,
-	0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
-	0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693,
-	0x54de5729, 0x23d967bf, 0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
-	0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
-};
-
-
-MsgPacket::MsgPacket() : m_packet(NULL), m_size(InitialPacketSize), m_usage(HeaderLength), m_readposition(HeaderLength), m_freezed(false), m_payloadchecksum(true) {
+
+MsgPayload::MsgPayload(uint8_t* data, uint32_t length) : m_data(data), m_length(length), m_refcount(1) {
+}
+
+MsgPayload::~MsgPayload() {
+	free(m_data);
+}
+
+MsgPayload* MsgPayload::create(const uint8_t* data, uint32_t length) {
+	uint8_t* buffer = (uint8_t*)malloc(length);
+
+	if(buffer == NULL) {
+		return NULL;
+	}
+
+	memcpy(buffer, data, length);
+	return new MsgPayload(buffer, length);
+}
+
+void MsgPayload::ref() {
+	__sync_add_and_fetch(&m_refcount, 1);
+}
+
+void MsgPayload::unref() {
+	if(__sync_sub_and_fetch(&m_refcount, 1) == 0) {
+		delete this;
+	}
+}
+
+MsgPacket::MsgPacket() : m_packet(NULL), m_payload(NULL), m_size(InitialPacketSize), m_usage(HeaderLength), m_readposition(HeaderLength), m_freezed(false), m_payloadchecksum(true) {
 	Init(0, 0, 0);
 }
 
-MsgPacket::MsgPacket(uint16_t msgid, uint16_t type, uint32_t uid) : m_packet(NULL), m_size(InitialPacketSize), m_usage(HeaderLength), m_readposition(HeaderLength), m_freezed(false), m_payloadchecksum(true) {
-	Init(msgid, type, uid);
+MsgPacket::MsgPacket(uint16_t msgid, uint16_t type, uint32_t uid, bool uniqueid) : m_packet(NULL), m_payload(NULL), m_size(InitialPacketSize), m_usage(HeaderLength), m_readposition(HeaderLength), m_freezed(false), m_payloadchecksum(true) {
+	Init(msgid, type, uid, uniqueid);
 }
 
 MsgPacket::~MsgPacket() {
-	free(m_packet);
+	if(m_payload != NULL) {
+		m_payload->unref();
+	}
+
+	MsgPacketPool::release(m_packet, m_size);
 }
 
-void MsgPacket::Init(uint16_t msgid, uint16_t type, uint32_t uid) {
-	m_packet = (uint8_t*)malloc(m_size);
+void MsgPacket::Init(uint16_t msgid, uint16_t type, uint32_t uid, bool uniqueid) {
+	m_packet = MsgPacketPool::alloc(m_size);
 
 	if(m_packet == NULL) {
 		return;
 	}
 
-	pthread_mutex_lock(&uidmutex);
-
-	if(uid <= 0) {
-		uid = globalUID++;
-	}
-	else if(uid > globalUID) {
-		globalUID = uid + 1;
+	if(uniqueid) {
+		uid = createUID(uid);
 	}
 
-	pthread_mutex_unlock(&uidmutex);
-
 	memset(m_packet, 0, HeaderLength);
 
 	writePacket<uint32_t>(SyncPos, htobe32(0xAAAAAA));		// sync
@@ -120,6 +107,28 @@ void MsgPacket::Init(uint16_t msgid, uint16_t type, uint32_t uid) {
 	setType(type);											// message type
 }
 
+uint32_t MsgPacket::createUID(uint32_t uid) {
+	// new incremental id
+	if(uid == 0) {
+		return __sync_fetch_and_add(&globalUID, 1);
+	}
+
+	// explicit id -> advance the global id past it
+	uint32_t current = globalUID;
+
+	while(uid >= current) {
+		uint32_t previous = __sync_val_compare_and_swap(&globalUID, current, uid + 1);
+
+		if(previous == current) {
+			break;
+		}
+
+		current = previous;
+	}
+
+	return uid;
+}
+
 void MsgPacket::setClientID(uint16_t oid) {
 	writePacket<uint16_t>(ClientIDPos, htobe16(oid));
 }
@@ -193,6 +202,11 @@ bool MsgPacket::put_Blob(uint8_t source[], uint32_t length) {
 }
 
 void MsgPacket::clear() {
+	if(m_payload != NULL) {
+		m_payload->unref();
+		m_payload = NULL;
+	}
+
 	m_usage = HeaderLength;
 	m_readposition = HeaderLength;
 }
@@ -293,17 +307,68 @@ uint8_t* MsgPacket::getPacket() {
 }
 
 uint32_t MsgPacket::getPacketLength() {
-	return m_usage;
+	return m_usage + (m_payload ? m_payload->length() : 0);
 }
 
 uint8_t* MsgPacket::getPayload() {
 	return m_packet + HeaderLength;
 }
 
+bool MsgPacket::copy(uint8_t* dest, uint32_t offset, uint32_t length) {
+	if(offset + length > getPacketLength()) {
+		return false;
+	}
+
+	// inline data
+	if(offset < m_usage) {
+		uint32_t n = (length < m_usage - offset) ? length : m_usage - offset;
+		memcpy(dest, m_packet + offset, n);
+
+		dest += n;
+		offset += n;
+		length -= n;
+	}
+
+	// attached payload
+	if(length > 0) {
+		memcpy(dest, m_payload->data() + (offset - m_usage), length);
+	}
+
+	return true;
+}
+
 uint32_t MsgPacket::getPayloadLength() {
 	return m_usage - HeaderLength;
 }
 
+bool MsgPacket::attachPayload(MsgPayload* payload, uint32_t uncompressedLength) {
+	if(payload == NULL || m_payload != NULL || m_freezed) {
+		return false;
+	}
+
+	if(payload->length() == 0) {
+		return true;
+	}
+
+	// payload has been compressed before
+	if(uncompressedLength != 0) {
+		if(getPayloadLength() != 0) {
+			return false;
+		}
+
+		writePacket<uint32_t>(UncompressedPayloadLengthPos, htobe32(uncompressedLength));
+	}
+
+#ifdef WIN32
+	// no scatter / gather output, copy the data
+	return put_Blob(payload->data(), payload->length());
+#else
+	payload->ref();
+	m_payload = payload;
+	return true;
+#endif
+}
+
 uint32_t MsgPacket::getUID() {
 	return be32toh(readPacket<uint32_t>(UIDPos));
 }
@@ -346,20 +411,26 @@ void MsgPacket::freeze() {
 	}
 
 	uint32_t payloadCheckSum = 0;
+	uint32_t payloadLength = getPacketLength() - HeaderLength;
 
-	if(getPayloadLength() > 0 && m_payloadchecksum) {
+	if(payloadLength > 0 && m_payloadchecksum) {
 		payloadCheckSum = crc32(m_packet + HeaderLength, m_usage - HeaderLength);
+
+		if(m_payload != NULL) {
+			payloadCheckSum = crc32(m_payload->data(), m_payload->length(), payloadCheckSum);
+		}
 	}
 
 	writePacket<uint32_t>(PayloadCheckSumPos, htobe32(payloadCheckSum));
-	writePacket<uint32_t>(PayloadLengthPos, htobe32(m_usage - HeaderLength));
+	writePacket<uint32_t>(PayloadLengthPos, htobe32(payloadLength));
 	writePacket<uint32_t>(CheckSumPos, htobe32(crc32(m_packet, CheckSumPos)));
 
 	m_freezed = true;
 }
 
 bool MsgPacket::checkPacketSize(uint32_t bytes) {
-	if(bytes == 0) {
+	// nothing can be appended after an attached payload
+	if(bytes == 0 || m_payload != NULL) {
 		return false;
 	}
 
@@ -367,42 +438,36 @@ bool MsgPacket::checkPacketSize(uint32_t bytes) {
 		return true;
 	}
 
-	if(bytes < IncrementPacketSize) {
-		bytes = IncrementPacketSize;
-	}
-
-	uint8_t* buffer = (uint8_t*)realloc((void*)m_packet, m_usage + bytes);
+	uint32_t size = m_usage + bytes;
+	uint8_t* buffer = MsgPacketPool::alloc(size);
 
 	if(buffer == NULL) {
-		buffer = (uint8_t*)malloc(m_usage + bytes);
-
-		if(buffer == NULL) {
-			return false;
-		}
-
-		memcpy(buffer, m_packet, m_usage);
-		free(m_packet);
+		return false;
 	}
 
+	memcpy(buffer, m_packet, m_usage);
+	MsgPacketPool::release(m_packet, m_size);
+
 	m_packet = buffer;
-	m_size = m_usage + bytes;
+	m_size = size;
 	return true;
 }
 
-uint32_t MsgPacket::crc32(const uint8_t* buf, int size) {
-	uint32_t crc = 0xFFFFFFFF;
-	const uint8_t* p = buf;
-
-	while(size--) {
-		crc = crc32_tab[(crc ^ *p++) & 0xFF] ^(crc >> 8);
-	}
-
-	return (crc ^ ~0U);
+uint32_t MsgPacket::crc32(const uint8_t* buf, int size, uint32_t crc) {
+	return MsgCrc32::checksum(buf, size, crc);
 }
 
 bool MsgPacket::write(int fd, int timeout_ms) {
 	freeze();
 
+#ifndef WIN32
+	// packet with shared payload -> gather header and payload
+	if(m_payload != NULL) {
+		MsgPacket* p = this;
+		return (write(fd, &p, 1, timeout_ms) == 1);
+	}
+#endif
+
 	uint32_t written = 0;
 
 	while(written < m_usage) {
@@ -430,6 +495,162 @@ bool MsgPacket::write(int fd, int timeout_ms) {
 	return true;
 }
 
+int MsgPacket::write(int fd, MsgPacket* packets[], int count, int timeout_ms) {
+#ifdef WIN32
+	for(int i = 0; i < count; i++) {
+		if(!packets[i]->write(fd, timeout_ms)) {
+			return i;
+		}
+	}
+
+	return count;
+#else
+	int done = 0;
+
+	while(done < count) {
+		struct iovec iov[2 * MaxBatchSize];
+		int last[MaxBatchSize];
+		int iovcnt = 0;
+		int n = count - done;
+
+		if(n > MaxBatchSize) {
+			n = MaxBatchSize;
+		}
+
+		// gather header and payload data of all packets
+		for(int i = 0; i < n; i++) {
+			MsgPacket* p = packets[done + i];
+			p->freeze();
+
+			iov[iovcnt].iov_base = p->m_packet;
+			iov[iovcnt].iov_len = p->m_usage;
+			iovcnt++;
+
+			if(p->m_payload != NULL) {
+				iov[iovcnt].iov_base = p->m_payload->data();
+				iov[iovcnt].iov_len = p->m_payload->length();
+				iovcnt++;
+			}
+
+			last[i] = iovcnt;
+		}
+
+		int first = 0;
+		int completed = 0;
+
+		while(first < iovcnt) {
+			if(pollfd(fd, timeout_ms, false) == 0) {
+				return done + completed;
+			}
+
+			struct msghdr msg;
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = iov + first;
+			msg.msg_iovlen = iovcnt - first;
+
+			int rc = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+			if(rc == -1 && sockerror() == ENOTSOCK) {
+				rc = ::writev(fd, iov + first, iovcnt - first);
+			}
+
+			if(rc == -1 || rc == 0) {
+				if(sockerror() == SEWOULDBLOCK) {
+					continue;
+				}
+
+				return done + completed;
+			}
+
+			// skip written data (partial writes)
+			size_t written = rc;
+
+			while(written > 0 && first < iovcnt) {
+				if(written >= iov[first].iov_len) {
+					written -= iov[first].iov_len;
+					first++;
+					continue;
+				}
+
+				iov[first].iov_base = (uint8_t*)iov[first].iov_base + written;
+				iov[first].iov_len -= written;
+				written = 0;
+			}
+
+			while(completed < n && last[completed] <= first) {
+				completed++;
+			}
+		}
+
+		done += n;
+	}
+
+	return done;
+#endif
+}
+
+bool MsgPacket::sendfile(int fd, int file, uint64_t offset, uint32_t length, int timeout_ms) {
+	// the file range must be the last part of the payload
+	if(m_freezed || m_payload != NULL) {
+		return false;
+	}
+
+#ifndef __linux__
+	// no zero-copy support -> read the file range into the packet
+	uint8_t* data = reserve(length);
+
+	if(data == NULL) {
+		return false;
+	}
+
+#ifdef WIN32
+	if(lseek(file, offset, SEEK_SET) == -1 || ::read(file, data, length) != (int)length) {
+#else
+	if(pread(file, data, length, offset) != (ssize_t)length) {
+#endif
+		return false;
+	}
+
+	return write(fd, timeout_ms);
+#else
+	// the file data never passes through this process
+	disablePayloadCheckSum();
+	freeze();
+
+	// announce the file range in the header
+	writePacket<uint32_t>(PayloadLengthPos, htobe32(getPayloadLength() + length));
+	writePacket<uint32_t>(CheckSumPos, htobe32(crc32(m_packet, CheckSumPos)));
+
+	if(!write(fd, timeout_ms)) {
+		return false;
+	}
+
+	off_t pos = offset;
+	uint32_t written = 0;
+
+	while(written < length) {
+		if(pollfd(fd, timeout_ms, false) == 0) {
+			return false;
+		}
+
+		ssize_t rc = ::sendfile(fd, file, &pos, length - written);
+
+		if(rc == -1 && errno == EAGAIN) {
+			continue;
+		}
+
+		// short file -> the stream can't be completed anymore
+		if(rc <= 0) {
+			return false;
+		}
+
+		written += rc;
+	}
+
+	return true;
+#endif
+}
+
 MsgPacket* MsgPacket::read(int fd, int timeout_ms) {
 	bool bClosed;
 	return read(fd, bClosed, timeout_ms);
@@ -440,7 +661,8 @@ MsgPacket* MsgPacket::read(int fd, bool& closed, int timeout_ms) {
 		return NULL;
 	}
 
-	MsgPacket* p = new MsgPacket(0, 0, 1);
+	// the uid will be read from the header
+	MsgPacket* p = new MsgPacket(0, 0, 0, false);
 
 	if(p == NULL) {
 		return NULL;
@@ -601,12 +823,22 @@ bool MsgPacket::readstream(std::istream& in, MsgPacket& p) {
 	return true;
 }
 
+bool MsgPacket::writestream(std::ostream& out) {
+	out.write((const char*)m_packet, m_usage);
+
+	if(m_payload != NULL) {
+		out.write((const char*)m_payload->data(), m_payload->length());
+	}
+
+	return out.good();
+}
+
 bool MsgPacket::compress(int level) {
 #ifndef HAVE_ZLIB
 	return false;
 #else
 
-	if(level <= 0 || level > 9 || m_freezed) {
+	if(level <= 0 || level > 9 || m_freezed || m_payload != NULL) {
 		return false;
 	}
 
@@ -702,6 +934,6 @@ void MsgPacket::print() {
 	std::cout << "Owner ID       : " << std::dec << getClientID() << std::endl;
 	std::cout << "Total length   : " << std::dec << getPacketLength() << " bytes" << std::endl;
 	std::cout << "Header length  : " << HeaderLength << " bytes" << std::endl;
-	std::cout << "Payload length : " << getPayloadLength() << " bytes" << std::endl;
+	std::cout << "Payload length : " << getPacketLength() - HeaderLength << " bytes" << std::endl;
 	std::cout << "-------------------------------------------" << std::endl;
 }
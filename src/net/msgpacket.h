@@ -27,6 +27,52 @@
 // 24     uint32_t   uncompressed payload length (indicates compression if > 0)
 // 28     uint32_t   header checksum
 
+/**
+	@short Shared payload data
+
+	A reference counted block of payload data. A payload can be attached to several
+	packets (e.g. the same stream packet sent to multiple clients) without copying it.
+*/
+
+class MsgPayload {
+public:
+
+	/**
+	Create a new payload.
+	Copies the data into a new payload object with a reference count of 1.
+
+	@param	data		pointer to payload data
+	@param	length		size of the data in bytes
+	@return pointer to the payload or NULL on memory allocation error
+	*/
+	static MsgPayload* create(const uint8_t* data, uint32_t length);
+
+	/**
+	Add a reference.
+	*/
+	void ref();
+
+	/**
+	Release a reference.
+	The payload is deleted with its last reference.
+	*/
+	void unref();
+
+	uint8_t* data() { return m_data; }
+
+	uint32_t length() { return m_length; }
+
+private:
+
+	MsgPayload(uint8_t* data, uint32_t length);
+
+	~MsgPayload();
+
+	uint8_t* m_data;
+	uint32_t m_length;
+	volatile int m_refcount;
+};
+
 /**
 	@short Message Packet class
 
@@ -35,6 +81,8 @@
 */
 
 class MsgPacket {
+	friend class MsgReader;
+
 public:
 
 	/**
@@ -44,8 +92,9 @@ public:
 	@param	msgid			user defined message id
 	@param	type			user defined message type (default: 0)
 	@param	uid				packet uid (default: unique incremental id)
+	@param	uniqueid		false if the packet doesn't need a unique id (the uid is used as is)
 	*/
-	MsgPacket(uint16_t msgid, uint16_t type = 0, uint32_t uid = 0);
+	MsgPacket(uint16_t msgid, uint16_t type = 0, uint32_t uid = 0, bool uniqueid = true);
 
 	/**
 	MsgPacket constructor.
@@ -153,6 +202,18 @@ public:
 
 	void unreserve(uint32_t length);
 
+	/**
+	Attach shared payload data.
+	Appends a reference counted payload to the packet without copying it. The packet holds
+	a reference until it is destroyed or cleared. No further data can be added to the packet.
+	A payload compressed with compress() can be reused if it's the only payload data.
+
+	@param	payload		payload to attach
+	@param	uncompressedLength	original length of a compressed payload (0 = not compressed)
+	@return true on success
+	*/
+	bool attachPayload(MsgPayload* payload, uint32_t uncompressedLength = 0);
+
 	/**
 	Consume space.
 	Consume a memory region in the payload of the packet. consume is the counter-part of reserve.
@@ -304,9 +365,22 @@ public:
 	*/
 	uint32_t getPacketLength();
 
+	/**
+	Copy packet data.
+	Copies a part of the complete packet data (header, payload and attached payload).
+	The packet should be frozen before.
+
+	@param	dest		destination buffer
+	@param	offset		offset within the packet data
+	@param	length		number of bytes to copy
+	@return true on success
+	*/
+	bool copy(uint8_t* dest, uint32_t offset, uint32_t length);
+
 	/**
 	Get pointer to payload data.
-	Returns a pointer to the packets packets payload data
+	Returns a pointer to the packets packets payload data. An attached payload
+	isn't part of this buffer.
 
 	@return pointer to payload data
 	*/
@@ -314,7 +388,8 @@ public:
 
 	/**
 	Get payload length.
-	Return the size of the packets payload
+	Return the size of the payload data returned by getPayload(). The size of
+	an attached payload is only included in getPacketLength().
 
 	@return payload size
 	*/
@@ -428,6 +503,32 @@ public:
 	*/
 	bool write(int fd, int timeout_ms = 3000);
 
+	/**
+	Write multiple packets to socket.
+	Writes the data of all packets with as few system calls as possible (scatter / gather).
+
+	@param	fd			filedescriptor of the socket
+	@param	packets		array of packets to write
+	@param	count		number of packets in the array
+	@param	timeout_ms	write operation timeout in milliseconds
+	@return number of completely written packets
+	*/
+	static int write(int fd, MsgPacket* packets[], int count, int timeout_ms = 3000);
+
+	/**
+	Write packet with file data to socket.
+	Sends the packet followed by a range of a file as trailing payload. On Linux
+	the file data is passed to the socket with sendfile() and never enters
+	userspace, so the payload checksum is disabled for this packet.
+
+	@param	fd		filedescriptor of the socket
+	@param	file	filedescriptor of the file
+	@param	offset	start of the range in the file
+	@param	length	number of bytes to send from the file
+	@param	timeout_ms	write operation timeout in milliseconds
+	*/
+	bool sendfile(int fd, int file, uint64_t offset, uint32_t length, int timeout_ms = 3000);
+
 	/**
 	Receive packet from socket.
 	Create a new packet from incoming socket data
@@ -451,6 +552,8 @@ public:
 
 	static bool readstream(std::istream& in, MsgPacket& p);
 
+	bool writestream(std::ostream& out);
+
 	enum {
 		HeaderLength = 32,						/*!< Length (in bytes) of a packet header. */
 		CheckSumPos = 28,						/*!< Checksum position (uint32_t) within the header data. */
@@ -467,7 +570,7 @@ public:
 
 protected:
 
-	void Init(uint16_t msgid, uint16_t type = 0, uint32_t uid = 0);
+	void Init(uint16_t msgid, uint16_t type = 0, uint32_t uid = 0, bool uniqueid = true);
 
 	/**
 	Set unique message id.
@@ -482,9 +585,10 @@ protected:
 
 	@param  buf		pointer to data array
 	@param  size    size of array in bytes
+	@param  crc		crc of the preceding data (to continue a checksum)
 	@return 32bit crc
 	*/
-	static uint32_t crc32(const uint8_t* buf, int size);
+	static uint32_t crc32(const uint8_t* buf, int size, uint32_t crc = 0);
 
 	static int read(int fd, uint8_t* data, int datalen, int timeout_ms);
 
@@ -504,10 +608,12 @@ private:
 
 	bool checkPacketSize(uint32_t bytes);
 
+	static uint32_t createUID(uint32_t uid);
+
 	static uint32_t globalUID;
-	static uint32_t crc32_tab[];
 
 	uint8_t* m_packet;
+	MsgPayload* m_payload;
 	uint32_t m_size;
 	uint32_t m_usage;
 	uint32_t m_readposition;
@@ -517,14 +623,13 @@ private:
 
 	enum {
 		InitialPacketSize = 128,
-		IncrementPacketSize = 512
+		MaxBatchSize = 64
 	};
-
-	static pthread_mutex_t uidmutex;
 };
 
 inline std::ostream& operator<<(std::ostream& out, MsgPacket& p) {
-	return out.write((const char*)p.getPacket(), p.getPacketLength());
+	p.writestream(out);
+	return out;
 }
 
 inline std::istream& operator>>(std::istream& in, MsgPacket& p) {
@@ -569,6 +674,7 @@ class MsgPacket {
 .. memory allocation ..
 +uint8_t* reserve(uint32_t length, bool fill, unsigned char c)
 +uint8_t* consume(uint32_t length)
++bool attachPayload(MsgPayload* payload, uint32_t uncompressedLength)
 +void clear()
 .. compression ..
 +bool compress(int level)
@@ -576,9 +682,11 @@ class MsgPacket {
 .. transport ..
 +{static} MsgPacket* read(int fd, bool& closed, int timeout_ms)
 +bool write(int fd, int timeout_ms)
++{static} int write(int fd, MsgPacket* packets[], int count, int timeout_ms)
 --
 -{static} uint32_t globalUID
 -uint8_t* m_packet;
+-MsgPayload* m_payload;
 -uint32_t m_size;
 -uint32_t m_usage;
 -uint32_t m_readposition;
@@ -0,0 +1,154 @@
+/*
+ *      vdr-plugin-xvdr - XVDR server plugin for VDR
+ *
+ *      Copyright (C) 2013 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-xvdr
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <stdlib.h>
+
+#include "msgpool.h"
+
+#define POOL_BUCKET { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0 }
+
+// size classes: 128, 512, 2K, 8K, 32K, 128K bytes
+MsgPacketPool::Bucket MsgPacketPool::m_buckets[] = {
+	POOL_BUCKET, POOL_BUCKET, POOL_BUCKET, POOL_BUCKET, POOL_BUCKET, POOL_BUCKET
+};
+
+// maximum number of free buffers kept per class
+const uint32_t MsgPacketPool::m_maxFree[] = {
+	256, 256, 64, 32, 16, 8
+};
+
+uint64_t MsgPacketPool::m_heapAllocs = 0;
+
+int MsgPacketPool::getClass(uint32_t size) {
+	uint32_t classSize = MinClassSize;
+
+	for(int i = 0; i < ClassCount; i++) {
+		if(size <= classSize) {
+			return i;
+		}
+
+		classSize <<= 2;
+	}
+
+	return -1;
+}
+
+uint8_t* MsgPacketPool::alloc(uint32_t& size) {
+	int c = getClass(size);
+
+	// oversized buffer -> round up to the next power of two
+	if(c == -1) {
+		uint32_t capacity = MaxClassSize;
+
+		while(capacity < size && capacity < 0x80000000) {
+			capacity <<= 1;
+		}
+
+		if(capacity < size) {
+			capacity = size;
+		}
+
+		uint8_t* buffer = (uint8_t*)malloc(capacity);
+
+		if(buffer != NULL) {
+			size = capacity;
+			__sync_add_and_fetch(&m_heapAllocs, 1);
+		}
+
+		return buffer;
+	}
+
+	Bucket& b = m_buckets[c];
+	uint8_t* buffer = NULL;
+
+	pthread_mutex_lock(&b.lock);
+
+	if(b.head != NULL) {
+		buffer = b.head;
+		b.head = *(uint8_t**)buffer;
+		b.count--;
+		b.hits++;
+	}
+	else {
+		b.misses++;
+	}
+
+	pthread_mutex_unlock(&b.lock);
+
+	uint32_t capacity = MinClassSize << (2 * c);
+
+	if(buffer == NULL) {
+		buffer = (uint8_t*)malloc(capacity);
+
+		if(buffer == NULL) {
+			return NULL;
+		}
+	}
+
+	size = capacity;
+	return buffer;
+}
+
+void MsgPacketPool::release(uint8_t* buffer, uint32_t size) {
+	if(buffer == NULL) {
+		return;
+	}
+
+	int c = getClass(size);
+
+	// only buffers with the exact capacity of a class are pooled
+	if(c == -1 || size != ((uint32_t)MinClassSize << (2 * c))) {
+		free(buffer);
+		return;
+	}
+
+	Bucket& b = m_buckets[c];
+
+	pthread_mutex_lock(&b.lock);
+
+	if(b.count < m_maxFree[c]) {
+		*(uint8_t**)buffer = b.head;
+		b.head = buffer;
+		b.count++;
+		buffer = NULL;
+	}
+
+	pthread_mutex_unlock(&b.lock);
+
+	free(buffer);
+}
+
+void MsgPacketPool::getStatistics(uint64_t& hits, uint64_t& misses) {
+	hits = 0;
+	misses = __sync_add_and_fetch(&m_heapAllocs, 0);
+
+	for(int i = 0; i < ClassCount; i++) {
+		Bucket& b = m_buckets[i];
+
+		pthread_mutex_lock(&b.lock);
+		hits += b.hits;
+		misses += b.misses;
+		pthread_mutex_unlock(&b.lock);
+	}
+}
@@ -0,0 +1,74 @@
+/** \file msgpool.h
+	Header file for the MsgPacketPool class.
+	This include file defines the buffer pool used by MsgPacket
+*/
+
+#ifndef MSGPOOL_H
+#define MSGPOOL_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+/**
+	@short Packet buffer pool
+
+	Thread-safe pool of packet buffers. Buffers are grouped into size classes,
+	released buffers are kept on a freelist of their class and handed out again
+	on the next allocation. Buffers larger than the biggest class are allocated
+	from the heap directly.
+*/
+
+class MsgPacketPool {
+public:
+
+	/**
+	Allocate a packet buffer.
+	The requested size is rounded up to the capacity of the buffer.
+
+	@param	size		requested size in bytes, receives the capacity of the buffer
+	@return pointer to the buffer or NULL on memory allocation error
+	*/
+	static uint8_t* alloc(uint32_t& size);
+
+	/**
+	Return a packet buffer to the pool.
+
+	@param	buffer		buffer allocated with alloc()
+	@param	size		capacity of the buffer (as returned by alloc())
+	*/
+	static void release(uint8_t* buffer, uint32_t size);
+
+	/**
+	Get pool statistics.
+
+	@param	hits		number of allocations served from the pool
+	@param	misses		number of allocations served from the heap
+	*/
+	static void getStatistics(uint64_t& hits, uint64_t& misses);
+
+private:
+
+	static int getClass(uint32_t size);
+
+	struct Bucket {
+		pthread_mutex_t lock;
+		uint8_t* head;
+		uint32_t count;
+		uint64_t hits;
+		uint64_t misses;
+	};
+
+	enum {
+		ClassCount = 6,
+		MinClassSize = 128,
+		MaxClassSize = 131072
+	};
+
+	static Bucket m_buckets[ClassCount];
+
+	static const uint32_t m_maxFree[ClassCount];
+
+	static uint64_t m_heapAllocs;
+};
+
+#endif // MSGPOOL_H
@@ -0,0 +1,189 @@
+/*
+ *      vdr-plugin-xvdr - XVDR server plugin for VDR
+ *
+ *      Copyright (C) 2013 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-xvdr
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+
+#include "os-config.h"
+#include "msgpacket.h"
+#include "msgreader.h"
+
+MsgReader::MsgReader(int fd, uint32_t size) : m_fd(fd), m_size(size), m_start(0), m_end(0) {
+	m_buffer = (uint8_t*)malloc(m_size);
+}
+
+MsgReader::~MsgReader() {
+	free(m_buffer);
+}
+
+bool MsgReader::checkHeader() {
+	uint8_t* header = m_buffer + m_start;
+	uint32_t checksum;
+	memcpy(&checksum, header + MsgPacket::CheckSumPos, sizeof(checksum));
+
+	checksum = be32toh(checksum);
+	uint32_t test = MsgPacket::crc32(header, MsgPacket::CheckSumPos);
+
+	if(checksum != test) {
+		std::cerr << "checksum failed !" << std::endl;
+		std::cerr << "PACKET CHECKSUM  : " << std::hex << checksum << std::endl;
+		std::cerr << "COMPUTED CHECKSUM: " << std::hex << test << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+bool MsgReader::findSync() {
+	while(m_end - m_start >= sizeof(uint32_t)) {
+		uint32_t sync;
+		memcpy(&sync, m_buffer + m_start, sizeof(sync));
+
+		if(be32toh(sync) == 0xAAAAAA) {
+			return true;
+		}
+
+		m_start++;
+	}
+
+	return false;
+}
+
+int MsgReader::fill(int timeout_ms) {
+	// move remaining data to the start of the buffer
+	if(m_start > 0) {
+		memmove(m_buffer, m_buffer + m_start, m_end - m_start);
+		m_end -= m_start;
+		m_start = 0;
+	}
+
+	if(!pollfd(m_fd, timeout_ms, true)) {
+		return ETIMEDOUT;
+	}
+
+	int rc = recv(m_fd, (char*)(m_buffer + m_end), m_size - m_end, MSG_DONTWAIT);
+
+	if(rc == -1 && sockerror() == ENOTSOCK) {
+		rc = ::read(m_fd, m_buffer + m_end, m_size - m_end);
+	}
+
+	if(rc == 0) {
+		return ECONNRESET;
+	}
+	else if(rc == -1) {
+		return (sockerror() == SEWOULDBLOCK) ? 0 : sockerror();
+	}
+
+	m_end += rc;
+	return 0;
+}
+
+MsgPacket* MsgReader::read(bool& closed, int timeout_ms) {
+	closed = false;
+
+	if(m_buffer == NULL) {
+		return NULL;
+	}
+
+	for(;;) {
+		// complete header in buffer ?
+		if(findSync() && m_end - m_start >= MsgPacket::HeaderLength) {
+			if(checkHeader()) {
+				return parse(closed, timeout_ms);
+			}
+
+			// skip sync and rescan
+			m_start++;
+			continue;
+		}
+
+		int rc = fill(timeout_ms);
+
+		if(rc != 0) {
+			closed = (rc == ECONNRESET);
+			return NULL;
+		}
+	}
+}
+
+MsgPacket* MsgReader::parse(bool& closed, int timeout_ms) {
+	// the uid will be read from the header
+	MsgPacket* p = new MsgPacket(0, 0, 0, false);
+
+	if(p->getPacket() == NULL) {
+		delete p;
+		return NULL;
+	}
+
+	memcpy(p->getPacket(), m_buffer + m_start, MsgPacket::HeaderLength);
+	m_start += MsgPacket::HeaderLength;
+
+	// no payload ?
+	uint32_t datalen = be32toh(p->readPacket<uint32_t>(MsgPacket::PayloadLengthPos));
+
+	if(datalen == 0) {
+		return p;
+	}
+
+	uint8_t* data = p->reserve(datalen);
+
+	if(data == NULL) {
+		delete p;
+		return NULL;
+	}
+
+	// copy buffered payload, read the remaining part directly
+	uint32_t buffered = m_end - m_start;
+
+	if(buffered > datalen) {
+		buffered = datalen;
+	}
+
+	memcpy(data, m_buffer + m_start, buffered);
+	m_start += buffered;
+
+	if(buffered < datalen) {
+		int rc = socketread(m_fd, data + buffered, datalen - buffered, timeout_ms);
+
+		if(rc != 0) {
+			closed = (rc == ECONNRESET);
+			delete p;
+			return NULL;
+		}
+	}
+
+	// payload checksum validation
+	uint32_t plcs = p->getPayloadCheckSum();
+	p->m_payloadchecksum = (plcs != 0);
+
+	if(p->m_payloadchecksum && plcs != MsgPacket::crc32(data, datalen)) {
+		std::cerr << "wrong payload checksum !" << std::endl;
+		delete p;
+		return NULL;
+	}
+
+	return p;
+}
@@ -0,0 +1,61 @@
+/** \file msgreader.h
+	Header file for the MsgReader class.
+	This include file defines the buffered packet reader
+*/
+
+#ifndef MSGREADER_H
+#define MSGREADER_H
+
+#include <stdint.h>
+
+class MsgPacket;
+
+/**
+	@short Buffered packet reader
+
+	Reads packets from a socket through a receive buffer. Data is read in large
+	non-blocking chunks, packets are parsed from the buffer as long as complete
+	packets are available, the socket is only polled if the buffer runs empty.
+*/
+
+class MsgReader {
+public:
+
+	/**
+	MsgReader constructor.
+
+	@param	fd			filedescriptor of the socket
+	@param	size		size of the receive buffer in bytes
+	*/
+	MsgReader(int fd, uint32_t size = 64 * 1024);
+
+	virtual ~MsgReader();
+
+	/**
+	Read a packet.
+	Returns the next packet of the receive buffer, reads from the socket if needed.
+
+	@param	closed		set to true if connection has been closed
+	@param	timeout_ms	read operation timeout in milliseconds
+	@return pointer to new packet or NULL on timeout / error
+	*/
+	MsgPacket* read(bool& closed, int timeout_ms = 3000);
+
+private:
+
+	bool findSync();
+
+	bool checkHeader();
+
+	int fill(int timeout_ms);
+
+	MsgPacket* parse(bool& closed, int timeout_ms);
+
+	int m_fd;
+	uint8_t* m_buffer;
+	uint32_t m_size;
+	uint32_t m_start;
+	uint32_t m_end;
+};
+
+#endif // MSGREADER_H
@@ -32,22 +32,39 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <algorithm>
 #define __STDC_FORMAT_MACROS // Required for format specifiers
 #include <inttypes.h>
 
 #include "config/config.h"
+#include "tools/asyncio.h"
 
 #ifndef O_NOATIME
 #define O_NOATIME 0
 #endif
 
+// open segment files per recording
+#define MAX_OPEN_FILES 4
+
+// read-ahead for sequential playback
+#define READAHEAD_BLOCKS 4
+#define READAHEAD_BLOCKSIZE (256*1024)
+
+// size of an entry in the VDR index file
+#define INDEX_ENTRYSIZE 8
+
 cRecPlayer::cRecPlayer(cRecording* rec)
 {
-  m_file = -1;
-  m_fileOpen = -1;
   m_rescanInterval = 2000; // 2000 ms rescan interval
   m_recordingFilename = strdup(rec->FileName());
   m_totalLength = 0;
+  m_readPosition = 0;
+  m_dropPosition = 0;
+  m_index = NULL;
+  m_indexSize = 0;
+  m_framesPerSecond = rec->FramesPerSecond();
 
   // FIXME find out max file path / name lengths
 #if VDRVERSNUM < 10703
@@ -63,7 +80,8 @@ cRecPlayer::cRecPlayer(cRecording* rec)
 cRecPlayer::~cRecPlayer()
 {
   cleanup();
-  closeFile();
+  closeFiles();
+  unmapIndex();
   free(m_recordingFilename);
 }
 
@@ -78,29 +96,50 @@ void cRecPlayer::scan()
 {
   struct stat s;
   uint64_t len = m_totalLength;
-  m_totalLength = 0;
 
-  cleanup();
+  // completed segments don't change anymore, continue with the last one
+  int i = std::max(m_segments.Size() - 1, 0);
+  m_totalLength = (i < m_segments.Size()) ? m_segments[i]->start : 0;
 
-  for(int i = 0; ; i++) {
+  for(; ; i++) {
     fileNameFromIndex(i);
 
     if(stat(m_fileName, &s) == -1) {
       break;
     }
 
-    cSegment* segment = new cSegment();
+    // grow the last segment or append a new one
+    cSegment* segment = NULL;
+
+    if(i < m_segments.Size()) {
+      segment = m_segments[i];
+    }
+    else {
+      segment = new cSegment();
+      m_segments.Append(segment);
+    }
+
     segment->start = m_totalLength;
     segment->end = segment->start + s.st_size;
 
-    m_segments.Append(segment);
-
     m_totalLength += s.st_size;
   }
 
+  // last segment vanished -> start over
+  if(i < m_segments.Size()) {
+    INFOLOG("recording segment %i removed, rescanning", i);
+    cleanup();
+    m_totalLength = 0;
+    scan();
+    return;
+  }
+
   if(len != m_totalLength) {
     INFOLOG("recording scan: %"PRIu64" bytes", m_totalLength);
   }
+
+  // the index grows with the recording
+  mapIndex();
 }
 
 void cRecPlayer::update()
@@ -124,52 +163,228 @@ char* cRecPlayer::fileNameFromIndex(int index) {
   return m_fileName;
 }
 
-bool cRecPlayer::openFile(int index)
+int cRecPlayer::openFile(int index)
 {
-  if (index == m_fileOpen) return true;
-  closeFile();
+  // already open ?
+  for(std::deque<sFile>::iterator i = m_files.begin(); i != m_files.end(); i++)
+  {
+    if(i->index != index)
+      continue;
+
+    // most recently used first
+    sFile f = *i;
+    m_files.erase(i);
+    m_files.push_front(f);
+
+    return f.fd;
+  }
 
   fileNameFromIndex(index);
   INFOLOG("openFile called for index %i (%s)", index, m_fileName);
 
   // first try to open with NOATIME flag
-  m_file = open(m_fileName, O_RDONLY | O_NOATIME);
+  int fd = open(m_fileName, O_RDONLY | O_NOATIME);
 
   // fallback if FS doesn't support NOATIME
-  if (m_file == -1) {
-    m_file = open(m_fileName, O_RDONLY);
+  if (fd == -1) {
+    fd = open(m_fileName, O_RDONLY);
   }
 
   // failed to open file
-  if (m_file == -1) {
+  if (fd == -1) {
     INFOLOG("file failed to open");
-    m_fileOpen = -1;
-    return false;
+    return -1;
   }
 
-  m_fileOpen = index;
-  return true;
+  // close the least recently used file
+  if(m_files.size() >= MAX_OPEN_FILES)
+  {
+    // pending reads may still use the file
+    dropReadAhead();
+
+    INFOLOG("file closed (index %i)", m_files.back().index);
+    close(m_files.back().fd);
+    m_files.pop_back();
+  }
+
+  sFile f;
+  f.index = index;
+  f.fd = fd;
+  m_files.push_front(f);
+
+  return fd;
+}
+
+void cRecPlayer::closeFiles()
+{
+  // pending reads still use the files
+  dropReadAhead();
+
+  while(!m_files.empty())
+  {
+    INFOLOG("file closed (index %i)", m_files.front().index);
+    close(m_files.front().fd);
+    m_files.pop_front();
+  }
+}
+
+uint64_t cRecPlayer::getLengthBytes()
+{
+  return m_totalLength;
 }
 
-void cRecPlayer::closeFile()
+void cRecPlayer::mapIndex()
 {
-  if(m_file == -1) {
+  char filename[512];
+  snprintf(filename, sizeof(filename), m_pesrecording ? "%s/index.vdr" : "%s/index", m_recordingFilename);
+
+  struct stat s;
+
+  if(stat(filename, &s) == -1) {
+    unmapIndex();
+    return;
+  }
+
+  // index unchanged
+  if(m_index != NULL && (size_t)s.st_size == m_indexSize)
+    return;
+
+  unmapIndex();
+
+  if(s.st_size < INDEX_ENTRYSIZE)
+    return;
+
+  int fd = open(filename, O_RDONLY);
+
+  if(fd == -1) {
+    ERRORLOG("unable to open index file: %s", filename);
+    return;
+  }
+
+  void* index = mmap(NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if(index == MAP_FAILED) {
+    ERRORLOG("unable to map index file: %s", filename);
     return;
   }
 
-  INFOLOG("file closed");
-  close(m_file);
+  m_index = (uint8_t*)index;
+  m_indexSize = s.st_size;
 
-  m_file = -1;
-  m_fileOpen = -1;
+  DEBUGLOG("index mapped: %i frames", getFrames());
 }
 
-uint64_t cRecPlayer::getLengthBytes()
+void cRecPlayer::unmapIndex()
 {
-  return m_totalLength;
+  if(m_index != NULL)
+    munmap(m_index, m_indexSize);
+
+  m_index = NULL;
+  m_indexSize = 0;
 }
 
-int cRecPlayer::getBlock(unsigned char* buffer, uint64_t position, int amount)
+bool cRecPlayer::readIndex(int frame, uint64_t& position, bool& independent)
+{
+  uint64_t entry;
+  memcpy(&entry, m_index + frame * INDEX_ENTRYSIZE, INDEX_ENTRYSIZE);
+  entry = le64toh(entry);
+
+  uint64_t offset;
+  int number;
+
+  // VDR's tIndexPes / tIndexTs structures
+  if(m_pesrecording) {
+    offset = entry & 0xFFFFFFFFULL;
+    independent = (((entry >> 32) & 0xFF) == 1); // I_FRAME
+    number = (entry >> 40) & 0xFF;
+  }
+  else {
+    offset = entry & 0xFFFFFFFFFFULL;
+    independent = ((entry >> 47) & 1);
+    number = (entry >> 48) & 0xFFFF;
+  }
+
+  // file numbers start with 1, the file may not be scanned yet
+  if(number < 1 || number > m_segments.Size())
+    return false;
+
+  position = m_segments[number - 1]->start + offset;
+  return true;
+}
+
+int cRecPlayer::getFrames()
+{
+  return m_indexSize / INDEX_ENTRYSIZE;
+}
+
+double cRecPlayer::getFramesPerSecond()
+{
+  return m_framesPerSecond;
+}
+
+bool cRecPlayer::getIFrame(int& frame, uint64_t& position)
+{
+  if(frame >= getFrames())
+    frame = getFrames() - 1;
+
+  // search backwards for the nearest independent frame
+  for(; frame >= 0; frame--) {
+    bool independent = false;
+
+    if(readIndex(frame, position, independent) && independent)
+      return true;
+  }
+
+  return false;
+}
+
+int cRecPlayer::getFrameNumber(uint64_t position)
+{
+  // offsets in the index are ascending
+  int first = 0;
+  int last = getFrames() - 1;
+  int frame = -1;
+
+  while(first <= last)
+  {
+    int i = (first + last) / 2;
+    uint64_t p = 0;
+    bool independent = false;
+
+    if(readIndex(i, p, independent) && p <= position) {
+      frame = i;
+      first = i + 1;
+    }
+    else
+      last = i - 1;
+  }
+
+  return frame;
+}
+
+int cRecPlayer::findSegment(uint64_t position)
+{
+  // segments are sorted by their start offset
+  int first = 0;
+  int last = m_segments.Size() - 1;
+
+  while(first <= last)
+  {
+    int i = (first + last) / 2;
+
+    if (position < m_segments[i]->start)
+      last = i - 1;
+    else if (position >= m_segments[i]->end)
+      first = i + 1;
+    else
+      return i;
+  }
+
+  return -1;
+}
+
+int cRecPlayer::checkBlock(uint64_t position, int amount)
 {
   // dont let the block be larger than 256 kb
   if (amount > 256*1024)
@@ -184,48 +399,234 @@ int cRecPlayer::getBlock(unsigned char* buffer, uint64_t position, int amount)
   if ((position + amount) > m_totalLength)
     amount = m_totalLength - position;
 
-  // work out what block "position" is in
-  int segmentNumber = -1;
-  for(int i = 0; i < m_segments.Size(); i++)
-  {
-    if ((position >= m_segments[i]->start) && (position < m_segments[i]->end)) {
-      segmentNumber = i;
-      break;
-    }
-  }
+  return amount;
+}
+
+int cRecPlayer::getBlock(unsigned char* buffer, uint64_t position, int amount)
+{
+  amount = checkBlock(position, amount);
+
+  if (amount <= 0)
+    return 0;
+
+  // random access -> forget the read-ahead blocks
+  bool sequential = (position == m_readPosition);
+
+  if(!sequential)
+    dropReadAhead();
 
-  // segment not found / invalid position
-  if (segmentNumber == -1) return 0;
+  // take what we have in memory, read the rest from the file
+  int bytes_read = readCached(buffer, position, amount);
 
-  // open file (if not already open)
-  if (!openFile(segmentNumber)) return 0;
+  if(bytes_read < amount)
+    bytes_read += readFile(&buffer[bytes_read], position + bytes_read, amount - bytes_read);
 
-  // work out position in current file
-  uint64_t filePosition = position - m_segments[segmentNumber]->start;
+  m_readPosition = position + bytes_read;
 
-  // seek to position
-  if(lseek(m_file, filePosition, SEEK_SET) == -1) {
-    ERRORLOG("unable to seek to position: %"PRIu64, filePosition);
+  // prefetch the next blocks
+  if(sequential && bytes_read > 0)
+    readAhead(m_readPosition);
+
+  return bytes_read;
+}
+
+int cRecPlayer::getFileBlock(uint64_t position, int amount, int& fd, uint64_t& offset)
+{
+  amount = checkBlock(position, amount);
+
+  if (amount <= 0)
     return 0;
-  }
 
-  // try to read the block
-  int bytes_read = read(m_file, buffer, amount);
-  DEBUGLOG("read %i bytes from file %i at position %llu", bytes_read, segmentNumber, filePosition);
+  // the block is on its way into our read-ahead buffers,
+  // getBlock() serves it from memory
+  bool sequential = (position == m_readPosition);
+
+  if(sequential && isReadAhead(position))
+    return 0;
+
+  dropReadAhead();
+
+  int segmentNumber = findSegment(position);
 
-  if(bytes_read <= 0) {
+  if (segmentNumber == -1)
     return 0;
+
+  // blocks spanning two segments are assembled by getBlock(),
+  // the client has to get the full amount it asked for
+  cSegment* segment = m_segments[segmentNumber];
+
+  if(position + amount > segment->end)
+    return 0;
+
+  fd = openFile(segmentNumber);
+
+  if (fd == -1)
+    return 0;
+
+  offset = position - segment->start;
+
+#ifndef __FreeBSD__
+  if(sequential) {
+    // the previous block has been sent
+    uint64_t drop = std::max(m_dropPosition, segment->start);
+
+    if(drop < position)
+      posix_fadvise(fd, drop - segment->start, position - drop, POSIX_FADV_DONTNEED);
   }
+#endif
+
+  m_dropPosition = position;
+  m_readPosition = position + amount;
+
+  // sequential playback continues from the read-ahead buffers
+  if(sequential)
+    readAhead(m_readPosition);
+
+  return amount;
+}
+
+bool cRecPlayer::isReadAhead(uint64_t position)
+{
+  if(m_readAhead.empty())
+    return false;
+
+  sBlock& b = m_readAhead.front();
+  return (b.position + b.used == position);
+}
+
+int cRecPlayer::readCached(unsigned char* buffer, uint64_t position, int amount)
+{
+  int bytes_read = 0;
+
+  while(!m_readAhead.empty() && bytes_read < amount)
+  {
+    sBlock& b = m_readAhead.front();
+    int length = b.request->Wait();
+
+    // read error or block doesn't match the position
+    if(length <= 0 || b.position + b.used != position) {
+      dropReadAhead();
+      break;
+    }
+
+    int n = std::min(length - (int)b.used, amount - bytes_read);
+    memcpy(&buffer[bytes_read], b.data + b.used, n);
+
+    b.used += n;
+    bytes_read += n;
+    position += n;
+
+    // partially consumed block
+    if((int)b.used < length)
+      break;
 
 #ifndef __FreeBSD__
-  // Tell linux not to bother keeping the data in the FS cache
-  posix_fadvise(m_file, filePosition, bytes_read, POSIX_FADV_DONTNEED);
+    // data behind the playback position isn't needed in the FS cache
+    posix_fadvise(b.request->GetFd(), b.request->GetOffset(), length, POSIX_FADV_DONTNEED);
 #endif
 
-  // divide and conquer
-  if(bytes_read < amount) {
-    bytes_read += getBlock(&buffer[bytes_read], position + bytes_read, amount - bytes_read);
+    delete b.request;
+    free(b.data);
+    m_readAhead.pop_front();
+  }
+
+  return bytes_read;
+}
+
+int cRecPlayer::readFile(unsigned char* buffer, uint64_t position, int amount)
+{
+  int bytes_read = 0;
+
+  while(bytes_read < amount)
+  {
+    // work out what block "position" is in
+    int segmentNumber = findSegment(position);
+
+    // segment not found / invalid position
+    if (segmentNumber == -1) break;
+
+    // open file (if not already open)
+    int fd = openFile(segmentNumber);
+    if (fd == -1) break;
+
+    // work out position in current file
+    cSegment* segment = m_segments[segmentNumber];
+    uint64_t filePosition = position - segment->start;
+    int length = std::min((uint64_t)(amount - bytes_read), segment->end - position);
+
+    // try to read the block
+    int rc = cAsyncIO::GetInstance().Read(fd, &buffer[bytes_read], length, filePosition);
+    DEBUGLOG("read %i bytes from file %i at position %llu", rc, segmentNumber, filePosition);
+
+    if(rc <= 0) {
+      if(rc < 0)
+        ERRORLOG("unable to read from position: %"PRIu64" (%s)", filePosition, strerror(-rc));
+      break;
+    }
+
+    bytes_read += rc;
+    position += rc;
   }
 
   return bytes_read;
 }
+
+void cRecPlayer::readAhead(uint64_t position)
+{
+  // continue behind the last queued block
+  if(!m_readAhead.empty()) {
+    sBlock& b = m_readAhead.back();
+    position = b.position + b.request->GetLength();
+  }
+
+  while(m_readAhead.size() < READAHEAD_BLOCKS)
+  {
+    int segmentNumber = findSegment(position);
+
+    if(segmentNumber == -1)
+      return;
+
+    int fd = openFile(segmentNumber);
+
+    if(fd == -1)
+      return;
+
+    cSegment* segment = m_segments[segmentNumber];
+    uint32_t length = std::min((uint64_t)READAHEAD_BLOCKSIZE, segment->end - position);
+
+    sBlock b;
+    b.position = position;
+    b.used = 0;
+    b.data = (uint8_t*)malloc(length);
+
+    if(b.data == NULL)
+      return;
+
+    b.request = new cAsyncRequest(fd, b.data, length, position - segment->start);
+
+    // engine busy
+    if(!cAsyncIO::GetInstance().Submit(b.request)) {
+      delete b.request;
+      free(b.data);
+      return;
+    }
+
+    m_readAhead.push_back(b);
+    position += length;
+  }
+}
+
+void cRecPlayer::dropReadAhead()
+{
+  while(!m_readAhead.empty())
+  {
+    sBlock& b = m_readAhead.front();
+
+    // the buffer is in use until the read has completed
+    b.request->Wait();
+
+    delete b.request;
+    free(b.data);
+    m_readAhead.pop_front();
+  }
+}
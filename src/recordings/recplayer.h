@@ -32,9 +32,12 @@
 #define XVDR_RECPLAYER_H
 
 #include <stdio.h>
+#include <deque>
 #include <vdr/tools.h>
 #include <vdr/recording.h>
 
+class cAsyncRequest;
+
 class cSegment
 {
   public:
@@ -53,9 +56,19 @@ public:
 
   int getBlock(unsigned char* buffer, uint64_t position, int amount);
 
-  bool openFile(int index);
+  int getFileBlock(uint64_t position, int amount, int& fd, uint64_t& offset);
+
+  int getFrames();
+
+  double getFramesPerSecond();
+
+  bool getIFrame(int& frame, uint64_t& position);
+
+  int getFrameNumber(uint64_t position);
+
+  int openFile(int index);
 
-  void closeFile();
+  void closeFiles();
 
   void scan();
 
@@ -69,16 +82,58 @@ private:
 
   void checkBufferSize(int s);
 
+  int findSegment(uint64_t position);
+
+  int checkBlock(uint64_t position, int amount);
+
+  void mapIndex();
+
+  void unmapIndex();
+
+  bool readIndex(int frame, uint64_t& position, bool& independent);
+
+  int readFile(unsigned char* buffer, uint64_t position, int amount);
+
+  int readCached(unsigned char* buffer, uint64_t position, int amount);
+
+  void readAhead(uint64_t position);
+
+  bool isReadAhead(uint64_t position);
+
+  void dropReadAhead();
+
+  struct sBlock {
+    uint64_t position;
+    uint32_t used;
+    uint8_t* data;
+    cAsyncRequest* request;
+  };
+
+  std::deque<sBlock> m_readAhead;
+
+  uint64_t m_readPosition;
+
+  uint64_t m_dropPosition;
+
   bool m_pesrecording;
 
   char m_fileName[512];
 
-  int m_file;
+  struct sFile {
+    int index;
+    int fd;
+  };
 
-  int m_fileOpen;
+  std::deque<sFile> m_files;
 
   cVector<cSegment*> m_segments;
 
+  uint8_t* m_index;
+
+  size_t m_indexSize;
+
+  double m_framesPerSecond;
+
   uint64_t m_totalLength;
 
   char* m_recordingFilename;
@@ -0,0 +1,397 @@
+/*
+ *      vdr-plugin-xvdr - XVDR server plugin for VDR
+ *
+ *      Copyright (C) 2013 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-xvdr
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+// needs kernel headers >= 5.4
+#ifdef IORING_FEAT_SINGLE_MMAP
+#define HAVE_IO_URING
+#endif
+#endif
+
+#include "config/config.h"
+#include "asyncio.h"
+
+#define ASYNCIO_ENTRIES 64
+#define ASYNCIO_WORKERS 4
+
+// cAsyncRequest
+
+cAsyncRequest::cAsyncRequest(int fd, uint8_t* buffer, uint32_t length, uint64_t offset) : m_fd(fd), m_offset(offset), m_result(0), m_done(false)
+{
+  m_iov.iov_base = buffer;
+  m_iov.iov_len = length;
+}
+
+void cAsyncRequest::Complete(int result)
+{
+  cMutexLock lock(&m_lock);
+
+  m_result = result;
+  m_done = true;
+  m_cond.Broadcast();
+}
+
+int cAsyncRequest::Wait()
+{
+  cMutexLock lock(&m_lock);
+
+  while(!m_done)
+    m_cond.Wait(m_lock);
+
+  return m_result;
+}
+
+bool cAsyncRequest::IsDone()
+{
+  cMutexLock lock(&m_lock);
+  return m_done;
+}
+
+int cAsyncRequest::GetResult()
+{
+  cMutexLock lock(&m_lock);
+  return m_result;
+}
+
+// worker thread (fallback engine)
+
+class cAsyncIO::cWorker : public cThread
+{
+public:
+
+  cWorker(cAsyncIO* io) : cThread("cAsyncIO worker"), m_io(io) {}
+
+  virtual ~cWorker() { Cancel(3); }
+
+protected:
+
+  void Action() { m_io->ProcessRequests(); }
+
+private:
+
+  cAsyncIO* m_io;
+};
+
+// cAsyncIO
+
+cAsyncIO::cAsyncIO() : cThread("cAsyncIO completion"), m_ringfd(-1), m_entries(0), m_inflight(0), m_sqptr(NULL), m_sqsize(0), m_cqptr(NULL), m_cqsize(0), m_sqes(NULL), m_sqessize(0), m_stop(false)
+{
+  if(SetupRing(ASYNCIO_ENTRIES)) {
+    Start();
+  }
+  else {
+    for(int i = 0; i < ASYNCIO_WORKERS; i++) {
+      m_workers.push_back(new cWorker(this));
+      m_workers.back()->Start();
+    }
+  }
+
+  INFOLOG("Async I/O engine: %s", GetEngineName());
+}
+
+cAsyncIO::~cAsyncIO()
+{
+  {
+    cMutexLock lock(&m_lock);
+    m_stop = true;
+    m_cond.Broadcast();
+  }
+
+  for(std::vector<cWorker*>::iterator i = m_workers.begin(); i != m_workers.end(); i++)
+    delete *i;
+
+  CloseRing();
+}
+
+cAsyncIO& cAsyncIO::GetInstance()
+{
+  static cAsyncIO singleton;
+  return singleton;
+}
+
+const char* cAsyncIO::GetEngineName()
+{
+  return (m_ringfd != -1) ? "io_uring" : "thread pool";
+}
+
+bool cAsyncIO::Submit(cAsyncRequest* r)
+{
+  if(m_ringfd != -1)
+    return SubmitRing(r);
+
+  cMutexLock lock(&m_lock);
+
+  if(m_stop)
+    return false;
+
+  m_requests.push_back(r);
+  m_cond.Broadcast();
+
+  return true;
+}
+
+int cAsyncIO::Read(int fd, uint8_t* buffer, uint32_t length, uint64_t offset)
+{
+  cAsyncRequest r(fd, buffer, length, offset);
+
+  // engine busy -> read directly
+  if(!Submit(&r)) {
+    int rc = pread(fd, buffer, length, offset);
+    return (rc < 0) ? -errno : rc;
+  }
+
+  return r.Wait();
+}
+
+void cAsyncIO::ProcessRequests()
+{
+  for(;;)
+  {
+    cAsyncRequest* r = NULL;
+
+    {
+      cMutexLock lock(&m_lock);
+
+      while(!m_stop && m_requests.empty())
+        m_cond.Wait(m_lock);
+
+      if(m_stop)
+        return;
+
+      r = m_requests.front();
+      m_requests.pop_front();
+    }
+
+    int rc = pread(r->m_fd, r->m_iov.iov_base, r->m_iov.iov_len, r->m_offset);
+    r->Complete((rc < 0) ? -errno : rc);
+  }
+}
+
+#ifdef HAVE_IO_URING
+
+bool cAsyncIO::SetupRing(uint32_t entries)
+{
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+
+  int fd = syscall(__NR_io_uring_setup, entries, &p);
+
+  if(fd < 0) {
+    INFOLOG("io_uring not available (%s)", strerror(errno));
+    return false;
+  }
+
+  m_ringfd = fd;
+  m_entries = p.sq_entries;
+
+  m_sqsize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  m_cqsize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+  // submission and completion queue may share a single mapping
+  if(p.features & IORING_FEAT_SINGLE_MMAP) {
+    if(m_cqsize > m_sqsize)
+      m_sqsize = m_cqsize;
+    m_cqsize = 0;
+  }
+
+  m_sqptr = mmap(NULL, m_sqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+
+  if(m_sqptr == MAP_FAILED) {
+    m_sqptr = NULL;
+    CloseRing();
+    return false;
+  }
+
+  if(m_cqsize == 0)
+    m_cqptr = m_sqptr;
+  else
+    m_cqptr = mmap(NULL, m_cqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+
+  m_sqessize = p.sq_entries * sizeof(struct io_uring_sqe);
+  m_sqes = mmap(NULL, m_sqessize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+  if(m_cqptr == MAP_FAILED || m_sqes == MAP_FAILED) {
+    if(m_cqptr == MAP_FAILED)
+      m_cqptr = NULL;
+    if(m_sqes == MAP_FAILED)
+      m_sqes = NULL;
+    CloseRing();
+    return false;
+  }
+
+  uint8_t* sq = (uint8_t*)m_sqptr;
+  uint8_t* cq = (uint8_t*)m_cqptr;
+
+  m_sqtail = (unsigned*)(sq + p.sq_off.tail);
+  m_sqmask = (unsigned*)(sq + p.sq_off.ring_mask);
+  m_sqarray = (unsigned*)(sq + p.sq_off.array);
+
+  m_cqhead = (unsigned*)(cq + p.cq_off.head);
+  m_cqtail = (unsigned*)(cq + p.cq_off.tail);
+  m_cqmask = (unsigned*)(cq + p.cq_off.ring_mask);
+  m_cqes = cq + p.cq_off.cqes;
+
+  return true;
+}
+
+void cAsyncIO::CloseRing()
+{
+  if(m_ringfd == -1)
+    return;
+
+  // wake up the completion thread with an empty request
+  if(Active()) {
+    Cancel(-1);
+
+    cMutexLock lock(&m_lock);
+    unsigned tail = *m_sqtail;
+    unsigned index = tail & *m_sqmask;
+
+    struct io_uring_sqe* sqe = &((struct io_uring_sqe*)m_sqes)[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_NOP;
+
+    m_sqarray[index] = index;
+    __sync_synchronize();
+    *m_sqtail = tail + 1;
+    __sync_synchronize();
+
+    syscall(__NR_io_uring_enter, m_ringfd, 1, 0, 0, NULL, 0);
+  }
+
+  Cancel(3);
+
+  if(m_sqes != NULL)
+    munmap(m_sqes, m_sqessize);
+
+  if(m_cqptr != NULL && m_cqptr != m_sqptr)
+    munmap(m_cqptr, m_cqsize);
+
+  if(m_sqptr != NULL)
+    munmap(m_sqptr, m_sqsize);
+
+  close(m_ringfd);
+  m_ringfd = -1;
+}
+
+bool cAsyncIO::SubmitRing(cAsyncRequest* r)
+{
+  cMutexLock lock(&m_lock);
+
+  // keep the completion queue from overflowing
+  if(m_stop || m_inflight >= m_entries)
+    return false;
+
+  unsigned tail = *m_sqtail;
+  unsigned index = tail & *m_sqmask;
+
+  struct io_uring_sqe* sqe = &((struct io_uring_sqe*)m_sqes)[index];
+  memset(sqe, 0, sizeof(*sqe));
+
+  sqe->opcode = IORING_OP_READV;
+  sqe->fd = r->m_fd;
+  sqe->addr = (uint64_t)(uintptr_t)&r->m_iov;
+  sqe->len = 1;
+  sqe->off = r->m_offset;
+  sqe->user_data = (uint64_t)(uintptr_t)r;
+
+  m_sqarray[index] = index;
+
+  __sync_synchronize();
+  *m_sqtail = tail + 1;
+  __sync_synchronize();
+
+  if(syscall(__NR_io_uring_enter, m_ringfd, 1, 0, 0, NULL, 0) != 1) {
+    ERRORLOG("io_uring submit failed (%s)", strerror(errno));
+    *m_sqtail = tail;
+    return false;
+  }
+
+  m_inflight++;
+  return true;
+}
+
+void cAsyncIO::Action()
+{
+  while(Running())
+  {
+    if(syscall(__NR_io_uring_enter, m_ringfd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+      ERRORLOG("io_uring wait failed (%s)", strerror(errno));
+      break;
+    }
+
+    unsigned head = *m_cqhead;
+    __sync_synchronize();
+
+    while(head != *m_cqtail)
+    {
+      struct io_uring_cqe* cqe = &((struct io_uring_cqe*)m_cqes)[head & *m_cqmask];
+      cAsyncRequest* r = (cAsyncRequest*)(uintptr_t)cqe->user_data;
+      int result = cqe->res;
+
+      head++;
+
+      // the NOP request used for wakeup has no request attached
+      if(r == NULL)
+        continue;
+
+      r->Complete(result);
+
+      cMutexLock lock(&m_lock);
+      m_inflight--;
+    }
+
+    __sync_synchronize();
+    *m_cqhead = head;
+  }
+}
+
+#else
+
+bool cAsyncIO::SetupRing(uint32_t entries)
+{
+  return false;
+}
+
+void cAsyncIO::CloseRing()
+{
+}
+
+bool cAsyncIO::SubmitRing(cAsyncRequest* r)
+{
+  return false;
+}
+
+void cAsyncIO::Action()
+{
+}
+
+#endif // HAVE_IO_URING
@@ -0,0 +1,170 @@
+/*
+ *      vdr-plugin-xvdr - XVDR server plugin for VDR
+ *
+ *      Copyright (C) 2013 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-xvdr
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef XVDR_ASYNCIO_H
+#define XVDR_ASYNCIO_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include <deque>
+#include <vector>
+#include <vdr/thread.h>
+
+class cAsyncIO;
+
+/**
+ * A single asynchronous read request.
+ * The buffer must stay valid until the request has completed.
+ */
+class cAsyncRequest
+{
+public:
+
+  cAsyncRequest(int fd, uint8_t* buffer, uint32_t length, uint64_t offset);
+
+  /** Wait for completion, returns the number of bytes read or -errno */
+  int Wait();
+
+  bool IsDone();
+
+  int GetResult();
+
+  int GetFd() { return m_fd; }
+
+  uint64_t GetOffset() { return m_offset; }
+
+  uint32_t GetLength() { return m_iov.iov_len; }
+
+  uint8_t* GetBuffer() { return (uint8_t*)m_iov.iov_base; }
+
+private:
+
+  friend class cAsyncIO;
+
+  void Complete(int result);
+
+  int m_fd;
+
+  struct iovec m_iov;
+
+  uint64_t m_offset;
+
+  int m_result;
+
+  bool m_done;
+
+  cMutex m_lock;
+
+  cCondVar m_cond;
+};
+
+/**
+ * Asynchronous file I/O.
+ * Uses io_uring if the kernel supports it, otherwise the requests are
+ * processed by a small pool of worker threads.
+ */
+class cAsyncIO : public cThread
+{
+public:
+
+  static cAsyncIO& GetInstance();
+
+  /** Submit a read request, returns false if the request couldn't be queued */
+  bool Submit(cAsyncRequest* r);
+
+  /** Read synchronously through the async engine */
+  int Read(int fd, uint8_t* buffer, uint32_t length, uint64_t offset);
+
+  const char* GetEngineName();
+
+protected:
+
+  cAsyncIO();
+
+  virtual ~cAsyncIO();
+
+  void Action();
+
+private:
+
+  class cWorker;
+
+  friend class cWorker;
+
+  bool SetupRing(uint32_t entries);
+
+  void CloseRing();
+
+  bool SubmitRing(cAsyncRequest* r);
+
+  void ProcessRequests();
+
+  // io_uring
+
+  int m_ringfd;
+
+  uint32_t m_entries;
+
+  uint32_t m_inflight;
+
+  void* m_sqptr;
+
+  size_t m_sqsize;
+
+  void* m_cqptr;
+
+  size_t m_cqsize;
+
+  void* m_sqes;
+
+  size_t m_sqessize;
+
+  unsigned* m_sqtail;
+
+  unsigned* m_sqmask;
+
+  unsigned* m_sqarray;
+
+  unsigned* m_cqhead;
+
+  unsigned* m_cqtail;
+
+  unsigned* m_cqmask;
+
+  void* m_cqes;
+
+  // thread pool fallback
+
+  std::deque<cAsyncRequest*> m_requests;
+
+  std::vector<cWorker*> m_workers;
+
+  bool m_stop;
+
+  cMutex m_lock;
+
+  cCondVar m_cond;
+};
+
+#endif // XVDR_ASYNCIO_H
@@ -0,0 +1,134 @@
+/*
+ *      vdr-plugin-xvdr - XVDR server plugin for VDR
+ *
+ *      Copyright (C) 2013 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-xvdr
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <stddef.h>
+#include "tssync.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define XVDR_TSSYNC_X86
+#include <immintrin.h>
+#endif
+
+#define TSSYNC_SIZE 188
+#define TSSYNC_BYTE 0x47
+
+typedef int (*TsFindSyncFunc)(const uint8_t* data, int length, int count, int start);
+
+// check candidate positions byte by byte
+static int TsFindSyncScalar(const uint8_t* data, int length, int count, int start)
+{
+  int last = length - (count - 1) * TSSYNC_SIZE;
+
+  for(int i = start; i < last; i++) {
+    if(data[i] != TSSYNC_BYTE)
+      continue;
+
+    int n = 1;
+    while(n < count && data[i + n * TSSYNC_SIZE] == TSSYNC_BYTE)
+      n++;
+
+    if(n == count)
+      return i;
+  }
+
+  return -1;
+}
+
+#ifdef XVDR_TSSYNC_X86
+
+// test 16 candidate positions at once: a lane survives if all
+// "count" bytes at TS packet stride are sync bytes
+__attribute__((target("sse2")))
+static int TsFindSyncSSE2(const uint8_t* data, int length, int count, int start)
+{
+  const __m128i sync = _mm_set1_epi8(TSSYNC_BYTE);
+  int last = length - (count - 1) * TSSYNC_SIZE - 16;
+  int i = start;
+
+  for(; i <= last; i += 16) {
+    const uint8_t* p = data + i;
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), sync));
+
+    for(int n = 1; mask != 0 && n < count; n++) {
+      p += TSSYNC_SIZE;
+      mask &= _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), sync));
+    }
+
+    if(mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+
+  return TsFindSyncScalar(data, length, count, i);
+}
+
+// same as above with 32 lanes
+__attribute__((target("avx2")))
+static int TsFindSyncAVX2(const uint8_t* data, int length, int count, int start)
+{
+  const __m256i sync = _mm256_set1_epi8(TSSYNC_BYTE);
+  int last = length - (count - 1) * TSSYNC_SIZE - 32;
+  int i = start;
+
+  for(; i <= last; i += 32) {
+    const uint8_t* p = data + i;
+    unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), sync));
+
+    for(int n = 1; mask != 0 && n < count; n++) {
+      p += TSSYNC_SIZE;
+      mask &= (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), sync));
+    }
+
+    if(mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+
+  return TsFindSyncSSE2(data, length, count, i);
+}
+
+#endif
+
+static TsFindSyncFunc SelectFindSync()
+{
+#ifdef XVDR_TSSYNC_X86
+  __builtin_cpu_init();
+
+  if(__builtin_cpu_supports("avx2"))
+    return TsFindSyncAVX2;
+
+  if(__builtin_cpu_supports("sse2"))
+    return TsFindSyncSSE2;
+#endif
+
+  return TsFindSyncScalar;
+}
+
+static TsFindSyncFunc FindSync = SelectFindSync();
+
+int TsFindSync(const uint8_t* data, int length, int count)
+{
+  if(data == NULL || count < 1 || length < (count - 1) * TSSYNC_SIZE + 1)
+    return -1;
+
+  return FindSync(data, length, count, 0);
+}
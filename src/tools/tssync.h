@@ -0,0 +1,38 @@
+/*
+ *      vdr-plugin-xvdr - XVDR server plugin for VDR
+ *
+ *      Copyright (C) 2013 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-xvdr
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef XVDR_TSSYNC_H
+#define XVDR_TSSYNC_H
+
+#include <stdint.h>
+
+/**
+ * Find the first TS packet boundary in a buffer.
+ * Returns the offset of the first position where the sync byte repeats
+ * at TS packet stride for "count" consecutive packets, or -1 if there
+ * is no such position. Uses SSE2 / AVX2 if the CPU supports it.
+ */
+int TsFindSync(const uint8_t* data, int length, int count = 2);
+
+#endif // XVDR_TSSYNC_H
@@ -0,0 +1,116 @@
+/*
+ *      vdr-plugin-xvdr - XVDR server plugin for VDR
+ *
+ *      Copyright (C) 2013 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-xvdr
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include "config/config.h"
+#include "net/msgpacket.h"
+#include "channellistcache.h"
+
+cChannelListCache::cChannelListCache() : m_hash(0) {
+}
+
+cChannelListCache::~cChannelListCache() {
+  Invalidate(0);
+}
+
+cChannelListCache& cChannelListCache::GetInstance() {
+  static cChannelListCache singleton;
+  return singleton;
+}
+
+void cChannelListCache::Invalidate(uint64_t hash) {
+  for(std::map<std::string, ListEntry>::iterator i = m_lists.begin(); i != m_lists.end(); i++) {
+    i->second.payload->unref();
+  }
+
+  m_lists.clear();
+  m_counts.clear();
+  m_hash = hash;
+}
+
+MsgPayload* cChannelListCache::Lookup(const std::string& key, uint64_t hash, uint32_t& uncompressedLength) {
+  cMutexLock lock(&m_mutex);
+
+  if(hash != m_hash) {
+    return NULL;
+  }
+
+  std::map<std::string, ListEntry>::iterator i = m_lists.find(key);
+
+  if(i == m_lists.end()) {
+    return NULL;
+  }
+
+  uncompressedLength = i->second.uncompressedLength;
+  i->second.payload->ref();
+
+  return i->second.payload;
+}
+
+void cChannelListCache::Store(const std::string& key, uint64_t hash, MsgPayload* payload, uint32_t uncompressedLength) {
+  cMutexLock lock(&m_mutex);
+
+  // channels changed -> drop all entries
+  if(hash != m_hash) {
+    Invalidate(hash);
+  }
+
+  std::map<std::string, ListEntry>::iterator i = m_lists.find(key);
+
+  if(i != m_lists.end()) {
+    i->second.payload->unref();
+  }
+
+  payload->ref();
+
+  ListEntry& entry = m_lists[key];
+  entry.payload = payload;
+  entry.uncompressedLength = uncompressedLength;
+}
+
+bool cChannelListCache::LookupCount(const std::string& key, uint64_t hash, int& count) {
+  cMutexLock lock(&m_mutex);
+
+  if(hash != m_hash) {
+    return false;
+  }
+
+  std::map<std::string, int>::iterator i = m_counts.find(key);
+
+  if(i == m_counts.end()) {
+    return false;
+  }
+
+  count = i->second;
+  return true;
+}
+
+void cChannelListCache::StoreCount(const std::string& key, uint64_t hash, int count) {
+  cMutexLock lock(&m_mutex);
+
+  if(hash != m_hash) {
+    Invalidate(hash);
+  }
+
+  m_counts[key] = count;
+}
@@ -0,0 +1,84 @@
+/*
+ *      vdr-plugin-xvdr - XVDR server plugin for VDR
+ *
+ *      Copyright (C) 2013 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-xvdr
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef XVDR_CHANNELLISTCACHE_H
+#define XVDR_CHANNELLISTCACHE_H
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vdr/thread.h>
+
+class MsgPayload;
+
+/**
+ * Cache for serialized channel lists.
+ *
+ * Entries are keyed by the filter signature of a client and are valid as
+ * long as the channel contents (cXVDRChannels::GetContentHash) don't change.
+ */
+class cChannelListCache
+{
+protected:
+
+  cChannelListCache();
+
+  virtual ~cChannelListCache();
+
+public:
+
+  static cChannelListCache& GetInstance();
+
+  /**
+   * Returns a referenced payload or NULL if there is no valid entry.
+   */
+  MsgPayload* Lookup(const std::string& key, uint64_t hash, uint32_t& uncompressedLength);
+
+  void Store(const std::string& key, uint64_t hash, MsgPayload* payload, uint32_t uncompressedLength);
+
+  bool LookupCount(const std::string& key, uint64_t hash, int& count);
+
+  void StoreCount(const std::string& key, uint64_t hash, int count);
+
+protected:
+
+  void Invalidate(uint64_t hash);
+
+private:
+
+  struct ListEntry {
+    MsgPayload* payload;
+    uint32_t uncompressedLength;
+  };
+
+  std::map<std::string, ListEntry> m_lists;
+
+  std::map<std::string, int> m_counts;
+
+  uint64_t m_hash;
+
+  cMutex m_mutex;
+};
+
+#endif // XVDR_CHANNELLISTCACHE_H
@@ -1,15 +1,23 @@
 #include <sys/wait.h>
 #include "config/config.h"
+#include "net/crc32.h"
 #include "tools/hash.h"
 #include "vdr/tools.h"
 #include "xvdrchannels.h"
 
+// full check of the channel contents (ms)
+#define CHANNELS_CHECK_INTERVAL 5000
+
 cXVDRChannels XVDRChannels;
 
 cXVDRChannels::cXVDRChannels() {
 	Channels.Lock(false);
 	channels = Reorder(&Channels);
 	channelsHash = ChannelsHash(&Channels);
+	contentHash = ContentHash(&Channels);
+	channelsCount = Channels.Count();
+	channelsMaxNumber = Channels.MaxNumber();
+	UpdateIndex();
 	Channels.Unlock();
 }
 
@@ -17,31 +25,43 @@ uint64_t cXVDRChannels::CheckUpdates() {
 	cRwLock::Lock(false);
 	Channels.Lock(false);
 
-	cChannels *oldChannels = channels;
 	uint64_t oldHash = channelsHash;
-	uint64_t newHash = ChannelsHash(&Channels);
-
-	if (newHash == oldHash) {
+	int count = Channels.Count();
+	int maxNumber = Channels.MaxNumber();
+
+	// Channels.Modified() can't be used, it resets the flag VDR needs to
+	// save channels.conf. Additions and removals show up in the count or
+	// numbering at once, everything else is found by the periodic check.
+	if (count == channelsCount && maxNumber == channelsMaxNumber &&
+			checkTimer.Elapsed() < CHANNELS_CHECK_INTERVAL) {
 		Channels.Unlock();
 		cRwLock::Unlock();
 		return oldHash;
 	}
 
+	uint64_t newContentHash = ContentHash(&Channels);
+
 	cRwLock::Unlock();
 	cRwLock::Lock(true);
 
-	if ((channelsHash == oldHash) && (channels == oldChannels)) {
+	channelsCount = count;
+	channelsMaxNumber = maxNumber;
+	checkTimer.Set(0);
+
+	// channels added, removed, moved or modified
+	if (newContentHash != contentHash) {
 		if (channels != &Channels) {
 			delete channels;
 		}
 
 		channels = Reorder(&Channels);
-		channelsHash = newHash;
-	} else {
-		// Seems another thread has already updated the hash.
-		newHash = channelsHash;
+		channelsHash = ChannelsHash(&Channels);
+		contentHash = newContentHash;
+		UpdateIndex();
 	}
 
+	uint64_t newHash = channelsHash;
+
 	Channels.Unlock();
 	cRwLock::Unlock();
 	return newHash;
@@ -51,6 +71,10 @@ cChannels* cXVDRChannels::Get() {
 	return channels;
 }
 
+uint64_t cXVDRChannels::GetContentHash() {
+	return contentHash;
+}
+
 cChannels* cXVDRChannels::Reorder(cChannels *channels) {
 	if (*XVDRServerConfig.ReorderCmd == NULL) {
 		return channels;
@@ -159,6 +183,110 @@ uint64_t cXVDRChannels::ChannelsHash(cChannels *channels) {
 	return (count << 32) | hash;
 }
 
+bool cXVDRChannels::ChannelIDLess::operator()(const tChannelID& a, const tChannelID& b) const {
+	if (a.Source() != b.Source()) {
+		return a.Source() < b.Source();
+	}
+	if (a.Nid() != b.Nid()) {
+		return a.Nid() < b.Nid();
+	}
+	if (a.Tid() != b.Tid()) {
+		return a.Tid() < b.Tid();
+	}
+	if (a.Sid() != b.Sid()) {
+		return a.Sid() < b.Sid();
+	}
+
+	return a.Rid() < b.Rid();
+}
+
+void cXVDRChannels::UpdateIndex() {
+	cMutexLock lock(&indexLock);
+
+	// forget the UIDs of removed channels
+	channelUIDs.clear();
+	channelIDs.clear();
+
+	for (cChannel *c = channels->First(); c != NULL; c = channels->Next(c)) {
+		tChannelID id = c->GetChannelID();
+		uint32_t uid = CreateStringHash(id.ToString());
+
+		channelUIDs[id] = uid;
+		channelIDs[uid] = id;
+	}
+}
+
+uint32_t cXVDRChannels::GetUID(const cChannel *channel) {
+	tChannelID id = channel->GetChannelID();
+	cMutexLock lock(&indexLock);
+
+	std::map<tChannelID, uint32_t, ChannelIDLess>::iterator i = channelUIDs.find(id);
+
+	if (i != channelUIDs.end()) {
+		return i->second;
+	}
+
+	// the UID depends on the channel id only
+	uint32_t uid = CreateStringHash(id.ToString());
+	channelUIDs[id] = uid;
+
+	return uid;
+}
+
+cChannel* cXVDRChannels::FindByUID(uint32_t uid) {
+	cMutexLock lock(&indexLock);
+
+	std::map<uint32_t, tChannelID>::iterator i = channelIDs.find(uid);
+
+	if (i == channelIDs.end()) {
+		return NULL;
+	}
+
+	return channels->GetByChannelID(i->second);
+}
+
+static uint32_t crc32int(int value, uint32_t crc) {
+	return MsgCrc32::checksum((const uint8_t*)&value, sizeof(value), crc);
+}
+
+static uint32_t crc32str(const char *value, uint32_t crc) {
+	return (value == NULL) ? crc : MsgCrc32::checksum((const uint8_t*)value, strlen(value) + 1, crc);
+}
+
+uint64_t cXVDRChannels::ContentHash(cChannels *channels) {
+	uint64_t count = 0;
+	uint32_t crc = 0;
+
+	// everything that ends up in a channel list or is used by the channel filters
+	for (cChannel *c = channels->First(); c != NULL; c = channels->Next(c)) {
+		count++;
+		crc = crc32int(c->Number(), crc);
+		crc = crc32int(c->GroupSep(), crc);
+		crc = crc32str(c->Name(), crc);
+		crc = crc32int(c->Source(), crc);
+		crc = crc32int(c->Nid(), crc);
+		crc = crc32int(c->Tid(), crc);
+		crc = crc32int(c->Sid(), crc);
+		crc = crc32int(c->Rid(), crc);
+		crc = crc32int(c->Vpid(), crc);
+		crc = crc32int(c->Vtype(), crc);
+
+		for (int i = 0; i < MAXCAIDS && c->Ca(i) != 0; i++) {
+			crc = crc32int(c->Ca(i), crc);
+		}
+		for (int i = 0; i < MAXAPIDS && c->Apid(i) != 0; i++) {
+			crc = crc32int(c->Apid(i), crc);
+			crc = crc32str(c->Alang(i), crc);
+		}
+		for (int i = 0; i < MAXDPIDS && c->Dpid(i) != 0; i++) {
+			crc = crc32int(c->Dpid(i), crc);
+			crc = crc32str(c->Dlang(i), crc);
+		}
+	}
+
+	return (count << 32) | crc;
+}
+
 bool cXVDRChannels::Read(FILE *f, cChannels *channels) {
 	cReadLine ReadLine;
 
@@ -5,24 +5,42 @@
 #ifndef XVDRCHANNELS_H_
 #define XVDRCHANNELS_H_
 
+#include <map>
 #include <vdr/channels.h>
+#include <vdr/thread.h>
 
 class cXVDRChannels: public cRwLock {
 private:
+	struct ChannelIDLess {
+		bool operator()(const tChannelID& a, const tChannelID& b) const;
+	};
+
 	cChannels *channels;
 	uint64_t channelsHash;
+	uint64_t contentHash;
+	int channelsCount;
+	int channelsMaxNumber;
+	cTimeMs checkTimer;
+	cMutex indexLock;
+	std::map<uint32_t, tChannelID> channelIDs;
+	std::map<tChannelID, uint32_t, ChannelIDLess> channelUIDs;
 	cChannels* Reorder(cChannels *channels);
 	bool Read(FILE *f, cChannels *channels);
 	bool Write(FILE *f, cChannels *channels);
 	uint64_t ChannelsHash(cChannels *channels);
+	uint64_t ContentHash(cChannels *channels);
+	void UpdateIndex();
 public:
 	cXVDRChannels();
 
 	/**
-	 * Calculates the VDR Channels hash and compares with the cached value
-	 * (channelsHash). If the value has changed an the ReorderCmd configuration
-	 * parameter is specified - reorder the VDR Channels list with the ReorderCmd
-	 * command and cache the reordered list.
+	 * Checks the channel count and the highest channel number first. Only
+	 * if they have changed or the check interval has expired, the content
+	 * hash of the VDR Channels is calculated and compared with the cached
+	 * value (contentHash). If the value has changed, the channels hash is
+	 * recalculated and - if the ReorderCmd configuration parameter is
+	 * specified - the VDR Channels list is reordered with the ReorderCmd
+	 * command and the reordered list is cached.
 	 *
 	 * Returns the calculated hash value.
 	 *
@@ -43,6 +61,28 @@ public:
 	 */
 	uint64_t GetHash();
 
+	/**
+	 * Returns the UID of the channel. UIDs are cached by channel id.
+	 */
+	uint32_t GetUID(const cChannel *channel);
+
+	/**
+	 * Returns the channel with the given UID or NULL if there isn't any.
+	 *
+	 * NOTE: Lock before calling this method.
+	 */
+	cChannel* FindByUID(uint32_t uid);
+
+	/**
+	 * Returns the content hash calculated on the prev. CheckUpdates().
+	 * It covers numbers, names, ids, PIDs, languages and CA ids. Unlike
+	 * the channels hash it also changes if channels are renamed, moved or
+	 * modified.
+	 *
+	 * NOTE: Lock before calling this method.
+	 */
+	uint64_t GetContentHash();
+
 	/**
 	 * Lock both this instance an the referencing channels list.
 	 */
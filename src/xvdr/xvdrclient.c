@@ -24,6 +24,7 @@
  */
 
 #include <stdlib.h>
+#include <limits.h>
 #include <stdio.h>
 #include <sys/socket.h>
 #include <unistd.h>
@@ -42,11 +43,13 @@
 #include <vdr/sources.h>
 
 #include "config/config.h"
-#include "live/livestreamer.h"
+#include "live/liveclient.h"
 #include "net/msgpacket.h"
+#include "net/msgreader.h"
 #include "recordings/recordingscache.h"
 #include "recordings/recplayer.h"
 #include "tools/hash.h"
+#include "xvdr/channellistcache.h"
 #include "xvdr/xvdrchannels.h"
 
 #include "xvdrcommand.h"
@@ -185,7 +188,7 @@ cXVDRClient::~cXVDRClient()
     cMutexLock lock(&m_queueLock);
     while(!m_queue.empty()) {
       MsgPacket* p = m_queue.front();
-      m_queue.pop();
+      m_queue.pop_front();
       delete p;
     }
   }
@@ -196,6 +199,7 @@ cXVDRClient::~cXVDRClient()
 void cXVDRClient::Action(void)
 {
   bool bClosed(false);
+  MsgReader reader(m_socket);
 
   // only root may change the priority
   if(geteuid() == 0) {
@@ -205,22 +209,9 @@ void cXVDRClient::Action(void)
   while (Running()) {
 
     // send pending messages
-    {
-      cMutexLock lock(&m_queueLock);
-
-      while(!m_queue.empty()) {
-        MsgPacket* p = m_queue.front();
-
-        if(!p->write(m_socket, m_timeout)) {
-          break;
-        }
+    SendQueue();
 
-        m_queue.pop();
-        delete p;
-      }
-    }
-
-    m_req = MsgPacket::read(m_socket, bClosed, 1000);
+    m_req = reader.read(bClosed, 1000);
 
     if(bClosed) {
       delete m_req;
@@ -244,7 +235,7 @@ void cXVDRClient::Action(void)
 
 int cXVDRClient::StartChannelStreaming(const cChannel *channel, uint32_t timeout, int32_t priority, bool waitforiframe)
 {
-  m_Streamer = new cLiveStreamer(priority, timeout, m_protocolVersion);
+  m_Streamer = new cLiveClient(priority, timeout, m_protocolVersion);
   m_Streamer->SetLanguage(m_LanguageIndex, m_LangStreamType);
 
   return m_Streamer->StreamChannel(channel, m_socket, waitforiframe);
@@ -503,6 +494,14 @@ bool cXVDRClient::processRequest()
       result = processChannelStream_Signal();
       break;
 
+    case XVDR_CHANNELSTREAM_SEEK:
+      result = processChannelStream_Seek();
+      break;
+
+    case XVDR_CHANNELSTREAM_SPEED:
+      result = processChannelStream_Speed();
+      break;
+
     /** OPCODE 40 - 59: XVDR network functions for recording streaming */
     case XVDR_RECSTREAM_OPEN:
       result = processRecStream_Open();
@@ -520,6 +519,10 @@ bool cXVDRClient::processRequest()
       result = processRecStream_Update();
       break;
 
+    case XVDR_RECSTREAM_SEEKTIME:
+      result = processRecStream_SeekTime();
+      break;
+
 
     /** OPCODE 60 - 79: XVDR network functions for channel access */
     case XVDR_CHANNELS_GETCOUNT:
@@ -836,8 +839,21 @@ bool cXVDRClient::processChannelStream_Close() /* OPCODE 21 */
 
 bool cXVDRClient::processChannelStream_Request() /* OPCODE 22 */
 {
-  if(m_Streamer != NULL)
+  if(m_Streamer == NULL)
+    return false;
+
+  // request without credit: send a single packet
+  if(m_req->eop())
+  {
     m_Streamer->RequestPacket();
+    return false;
+  }
+
+  // grant credit (packets, bytes) for streaming from the timeshift buffer
+  uint32_t packets = m_req->get_U32();
+  uint32_t bytes = m_req->eop() ? 0 : m_req->get_U32();
+
+  m_Streamer->AddCredit(packets, bytes);
 
   // no response needed for the request
   return false;
@@ -862,6 +878,45 @@ bool cXVDRClient::processChannelStream_Signal() /* OPCODE 24 */
   return false;
 }
 
+bool cXVDRClient::processChannelStream_Seek() /* OPCODE 25 */
+{
+  int64_t ts = m_req->get_S64();
+  bool relative = m_req->get_U32();
+
+  int64_t position = 0;
+  int64_t first = 0;
+  int64_t last = 0;
+
+  if(m_Streamer == NULL || !m_Streamer->Seek(ts, relative, position))
+  {
+    m_resp->put_U32(XVDR_RET_DATAINVALID);
+    return true;
+  }
+
+  m_Streamer->GetTimeRange(first, last);
+
+  m_resp->put_U32(XVDR_RET_OK);
+  m_resp->put_S64(position);
+  m_resp->put_S64(first);
+  m_resp->put_S64(last);
+
+  return true;
+}
+
+bool cXVDRClient::processChannelStream_Speed() /* OPCODE 26 */
+{
+  int32_t speed = m_req->get_S32();
+
+  if(m_Streamer == NULL || !m_Streamer->SetSpeed(speed))
+  {
+    m_resp->put_U32(XVDR_RET_DATAINVALID);
+    return true;
+  }
+
+  m_resp->put_U32(XVDR_RET_OK);
+  return true;
+}
+
 /** OPCODE 40 - 59: XVDR network functions for recording streaming */
 
 bool cXVDRClient::processRecStream_Open() /* OPCODE 40 */
@@ -926,6 +981,49 @@ bool cXVDRClient::processRecStream_Update() /* OPCODE 46 */
   return true;
 }
 
+bool cXVDRClient::processRecStream_SeekTime() /* OPCODE 47 */
+{
+  if(m_RecPlayer == NULL)
+    return false;
+
+  uint32_t mode  = m_req->get_U32();
+  uint64_t value = m_req->get_U64();
+
+  double fps = m_RecPlayer->getFramesPerSecond();
+  int frame = -1;
+
+  switch(mode)
+  {
+    case XVDR_SEEK_TIME:
+      frame = (value * fps / 1000 > INT_MAX) ? INT_MAX : (int)(value * fps / 1000);
+      break;
+
+    case XVDR_SEEK_FRAME:
+      frame = (value > INT_MAX) ? INT_MAX : (int)value;
+      break;
+
+    case XVDR_SEEK_POSITION:
+      frame = m_RecPlayer->getFrameNumber(value);
+      break;
+  }
+
+  // lookup the nearest preceding I-frame in the index
+  uint64_t position = 0;
+
+  if(frame < 0 || fps <= 0 || !m_RecPlayer->getIFrame(frame, position))
+  {
+    m_resp->put_U32(XVDR_RET_DATAUNKNOWN);
+    return true;
+  }
+
+  m_resp->put_U32(XVDR_RET_OK);
+  m_resp->put_U64(position);
+  m_resp->put_U32(frame);
+  m_resp->put_U64((uint64_t)(frame * 1000.0 / fps));
+
+  return true;
+}
+
 bool cXVDRClient::processRecStream_GetBlock() /* OPCODE 42 */
 {
   if (!m_RecPlayer)
@@ -937,6 +1035,26 @@ bool cXVDRClient::processRecStream_GetBlock() /* OPCODE 42 */
   uint64_t position  = m_req->get_U64();
   uint32_t amount    = m_req->get_U32();
 
+  // zero-copy: pass the file range directly to the socket
+  int fd = -1;
+  uint64_t offset = 0;
+  int length = m_RecPlayer->getFileBlock(position, amount, fd, offset);
+
+  // keep the order of the responses
+  if(length > 0 && SendQueue())
+  {
+    // the header has been sent, the stream can't be resynchronized
+    if(!m_resp->sendfile(m_socket, fd, offset, length, m_timeout))
+    {
+      ERRORLOG("failed to send block at position: %llu, closing connection", (unsigned long long)position);
+      shutdown(m_socket, SHUT_RDWR);
+    }
+
+    delete m_resp;
+    m_resp = NULL;
+    return false;
+  }
+
   uint8_t* p = m_resp->reserve(amount);
   uint32_t amountReceived = m_RecPlayer->getBlock(p, position, amount);
 
@@ -947,11 +1065,38 @@ bool cXVDRClient::processRecStream_GetBlock() /* OPCODE 42 */
   return true;
 }
 
+std::string cXVDRClient::ChannelFilterKey()
+{
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%i:%i:%i", m_wantfta, m_filterlanguage, m_filterlanguage ? m_LanguageIndex : -1);
+
+  std::string key = buffer;
+
+  for(std::list<int>::iterator i = m_caids.begin(); i != m_caids.end(); i++)
+  {
+    snprintf(buffer, sizeof(buffer), ":%04X", *i);
+    key += buffer;
+  }
+
+  return key;
+}
+
 int cXVDRClient::ChannelsCount()
 {
+  std::string key = ChannelFilterKey();
+  int count = 0;
+
   XVDRChannels.Lock(false);
+
+  uint64_t hash = XVDRChannels.GetContentHash();
+
+  if(cChannelListCache::GetInstance().LookupCount(key, hash, count))
+  {
+    XVDRChannels.Unlock();
+    return count;
+  }
+
   cChannels *channels = XVDRChannels.Get();
-  int count = 0;
 
   for (cChannel *channel = channels->First(); channel; channel = channels->Next(channel))
   {
@@ -959,6 +1104,8 @@ int cXVDRClient::ChannelsCount()
     if(IsChannelWanted(channel, true)) count++;
   }
 
+  cChannelListCache::GetInstance().StoreCount(key, hash, count);
+
   XVDRChannels.Unlock();
   return count;
 }
@@ -979,33 +1126,68 @@ bool cXVDRClient::processCHANNELS_GetChannels() /* OPCODE 63 */
 
   m_channelCount = ChannelsCount();
 
+  // serialized lists are shared by all clients with the same filter
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), ":%i:%u:%i", radio, m_protocolVersion, m_compressionLevel);
+
+  std::string key = ChannelFilterKey() + buffer;
+  uint32_t uncompressedLength = 0;
+
   if(!XVDRChannels.Lock(false)) {
     return true;
   }
 
-  cChannels *channels = XVDRChannels.Get();
+  // the cached list is valid as long as the channels are unchanged
+  uint64_t hash = XVDRChannels.GetContentHash();
+  MsgPayload* payload = cChannelListCache::GetInstance().Lookup(key, hash, uncompressedLength);
 
-  for (cChannel *channel = channels->First(); channel; channel = channels->Next(channel))
+  if(payload == NULL)
   {
-    if(!IsChannelWanted(channel, radio))
-      continue;
+    MsgPacket packet;
+    cChannels *channels = XVDRChannels.Get();
 
-    m_resp->put_U32(channel->Number());
-    m_resp->put_String(m_toUTF8.Convert(channel->Name()));
-    m_resp->put_U32(CreateChannelUID(channel));
-    m_resp->put_U32(channel->Ca());
+    for (cChannel *channel = channels->First(); channel; channel = channels->Next(channel))
+    {
+      if(!IsChannelWanted(channel, radio))
+        continue;
+
+      packet.put_U32(channel->Number());
+      packet.put_String(m_toUTF8.Convert(channel->Name()));
+      packet.put_U32(CreateChannelUID(channel));
+      packet.put_U32(channel->Ca());
+
+      // logo url
+      packet.put_String((const char*)CreateLogoURL(channel));
+
+      // service reference
+      if(m_protocolVersion > 4)
+        packet.put_String((const char*)CreateServiceReference(channel));
+    }
 
-    // logo url
-    m_resp->put_String((const char*)CreateLogoURL(channel));
+    uint32_t length = packet.getPayloadLength();
+
+    if(length == 0) {
+      XVDRChannels.Unlock();
+      return true;
+    }
+
+    if(packet.compress(m_compressionLevel) && packet.isCompressed())
+      uncompressedLength = length;
+
+    payload = MsgPayload::create(packet.getPayload(), packet.getPayloadLength());
+
+    if(payload == NULL) {
+      XVDRChannels.Unlock();
+      return true;
+    }
 
-    // service reference
-    if(m_protocolVersion > 4)
-      m_resp->put_String((const char*)CreateServiceReference(channel));
+    cChannelListCache::GetInstance().Store(key, hash, payload, uncompressedLength);
   }
 
   XVDRChannels.Unlock();
 
-  m_resp->compress(m_compressionLevel);
+  m_resp->attachPayload(payload, uncompressedLength);
+  payload->unref();
 
   return true;
 }
@@ -2019,5 +2201,32 @@ void cXVDRClient::SendScannerStatus() {
 
 void cXVDRClient::QueueMessage(MsgPacket* p) {
   cMutexLock lock(&m_queueLock);
-  m_queue.push(p);
+  m_queue.push_back(p);
+}
+
+bool cXVDRClient::SendQueue() {
+  cMutexLock lock(&m_queueLock);
+
+  while(!m_queue.empty()) {
+    MsgPacket* packets[64];
+    int count = 0;
+
+    for(; count < 64 && count < (int)m_queue.size(); count++) {
+      packets[count] = m_queue[count];
+    }
+
+    // send packets with a single (scatter / gather) write
+    int written = MsgPacket::write(m_socket, packets, count, m_timeout);
+
+    for(int i = 0; i < written; i++) {
+      m_queue.pop_front();
+      delete packets[i];
+    }
+
+    if(written < count) {
+      return false;
+    }
+  }
+
+  return true;
 }
@@ -29,7 +29,7 @@
 #include <map>
 #include <list>
 #include <string>
-#include <queue>
+#include <deque>
 
 #include <vdr/thread.h>
 #include <vdr/tools.h>
@@ -41,7 +41,7 @@
 
 class cChannel;
 class cDevice;
-class cLiveStreamer;
+class cLiveClient;
 class MsgPacket;
 class cRecPlayer;
 class cCmdControl;
@@ -55,7 +55,7 @@ private:
   int               m_socket;
   bool              m_loggedIn;
   bool              m_StatusInterfaceEnabled;
-  cLiveStreamer    *m_Streamer;
+  cLiveClient      *m_Streamer;
   cRecPlayer       *m_RecPlayer;
   MsgPacket        *m_req;
   MsgPacket        *m_resp;
@@ -74,7 +74,7 @@ private:
   cWirbelScan       m_scanner;
   std::string       m_clientName;
 
-  std::queue<MsgPacket*> m_queue;
+  std::deque<MsgPacket*> m_queue;
   cMutex                 m_queueLock;
 
 protected:
@@ -89,6 +89,8 @@ protected:
 
   void QueueMessage(MsgPacket* p);
 
+  bool SendQueue();
+
 public:
 
   cXVDRClient(int fd, unsigned int id);
@@ -121,6 +123,7 @@ private:
 
   void PutTimer(cTimer* timer, MsgPacket* p);
   bool IsChannelWanted(cChannel* channel, bool radio = false);
+  std::string ChannelFilterKey();
   int  ChannelsCount();
   cString CreateLogoURL(cChannel* channel);
   cString CreateServiceReference(cChannel* channel);
@@ -136,11 +139,14 @@ private:
   bool processChannelStream_Pause();
   bool processChannelStream_Request();
   bool processChannelStream_Signal();
+  bool processChannelStream_Seek();
+  bool processChannelStream_Speed();
 
   bool processRecStream_Open();
   bool processRecStream_Close();
   bool processRecStream_GetBlock();
   bool processRecStream_Update();
+  bool processRecStream_SeekTime();
 
   bool processCHANNELS_GroupsCount();
   bool processCHANNELS_ChannelsCount();
@@ -53,12 +53,15 @@
 #define XVDR_CHANNELSTREAM_REQUEST 22
 #define XVDR_CHANNELSTREAM_PAUSE   23
 #define XVDR_CHANNELSTREAM_SIGNAL  24
+#define XVDR_CHANNELSTREAM_SEEK    25
+#define XVDR_CHANNELSTREAM_SPEED   26
 
 /* OPCODE 40 - 59: XVDR network functions for recording streaming */
 #define XVDR_RECSTREAM_OPEN        40
 #define XVDR_RECSTREAM_CLOSE       41
 #define XVDR_RECSTREAM_GETBLOCK    42
 #define XVDR_RECSTREAM_UPDATE      46
+#define XVDR_RECSTREAM_SEEKTIME    47
 
 /* OPCODE 60 - 79: XVDR network functions for channel access */
 #define XVDR_CHANNELS_GETCOUNT     61
@@ -117,6 +120,11 @@
 #define XVDR_STATUS_RECORDINGSCHANGE 5
 #define XVDR_STATUS_CHANNELSCAN      6
 
+/** Recording seek modes */
+#define XVDR_SEEK_TIME      0
+#define XVDR_SEEK_FRAME     1
+#define XVDR_SEEK_POSITION  2
+
 /** Packet return codes */
 #define XVDR_RET_OK              0
 #define XVDR_RET_RECRUNNING      1
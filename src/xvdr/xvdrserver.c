@@ -36,6 +36,7 @@
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <inttypes.h>
 
 #include <vdr/plugin.h>
 #include <vdr/shutdown.h>
@@ -46,6 +47,7 @@
 #include "live/channelcache.h"
 #include "recordings/recordingscache.h"
 #include "net/os-config.h"
+#include "net/msgpool.h"
 
 //#define ENABLE_CHANNELTRIGGER 1
 
@@ -152,6 +154,11 @@ cXVDRServer::~cXVDRServer()
 
   cChannelCache::SaveChannelCacheData();
 
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  MsgPacketPool::getStatistics(hits, misses);
+  INFOLOG("packet buffer pool: %"PRIu64" hits, %"PRIu64" misses", hits, misses);
+
   INFOLOG("XVDR Server stopped");
 }
 
@@ -217,6 +224,10 @@ void cXVDRServer::NewClientConnected(int fd)
     INFOLOG("Client %s:%i with ID %d connected.", xvdr_inet_ntoa(((struct sockaddr_in6 *)&sin)->sin6_addr), ((struct sockaddr_in6 *)&sin)->sin6_port, m_IdCnt);
   else
     INFOLOG("Client %s:%i with ID %d connected.", inet_ntoa(((struct sockaddr_in *)&sin)->sin_addr), ((struct sockaddr_in *)&sin)->sin_port, m_IdCnt);
+
+  // the channel hashes aren't updated while no clients are connected
+  XVDRChannels.CheckUpdates();
+
   cXVDRClient *connection = new cXVDRClient(fd, m_IdCnt);
   m_clients.push_back(connection);
   m_IdCnt++;
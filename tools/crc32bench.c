@@ -0,0 +1,113 @@
+/*
+ *      XVDR CRC32 Benchmark Tool
+ *
+ *      Copyright (C) 2012 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-xvdr
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "net/crc32.h"
+
+static double now() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void usage() {
+	fprintf(stderr, "usage: crc32bench [blocksize] [megabytes]\n");
+	exit(1);
+}
+
+int main(int argc, char* argv[]) {
+	uint32_t blocksize = 64 * 1024;
+	uint32_t megabytes = 1024;
+
+	if(argc > 1) {
+		blocksize = atoi(argv[1]);
+	}
+
+	if(argc > 2) {
+		megabytes = atoi(argv[2]);
+	}
+
+	if(argc > 3 || blocksize == 0 || megabytes == 0) {
+		usage();
+	}
+
+	uint8_t* data = (uint8_t*)malloc(blocksize);
+
+	if(data == NULL) {
+		fprintf(stderr, "unable to allocate %u bytes\n", blocksize);
+		return 1;
+	}
+
+	for(uint32_t i = 0; i < blocksize; i++) {
+		data[i] = rand();
+	}
+
+	uint64_t total = (uint64_t)megabytes * 1024 * 1024;
+	uint64_t count = total / blocksize + 1;
+	uint32_t reference = MsgCrc32::checksum(MsgCrc32::Bytewise, data, blocksize);
+	int result = 0;
+
+	printf("block size: %u bytes, %u MB per engine (default: %s)\n", blocksize, megabytes, MsgCrc32::getName(MsgCrc32::getEngine()));
+
+	for(int e = MsgCrc32::Bytewise; e <= MsgCrc32::Pclmul; e++) {
+		MsgCrc32::Engine engine = (MsgCrc32::Engine)e;
+
+		if(!MsgCrc32::isSupported(engine)) {
+			printf("%-14s: not supported\n", MsgCrc32::getName(engine));
+			continue;
+		}
+
+		// check the implementation before measuring it
+		if(!MsgCrc32::selfTest(engine)) {
+			printf("%-14s: SELF TEST FAILED\n", MsgCrc32::getName(engine));
+			result = 2;
+			continue;
+		}
+
+		uint32_t crc = 0;
+		double start = now();
+
+		for(uint64_t n = 0; n < count; n++) {
+			crc = MsgCrc32::checksum(engine, data, blocksize);
+		}
+
+		double elapsed = now() - start;
+
+		printf("%-14s: %10.1f MB/s %s\n",
+			MsgCrc32::getName(engine),
+			(count * blocksize) / (1024.0 * 1024.0) / elapsed,
+			(crc == reference) ? "" : "(CHECKSUM MISMATCH)");
+
+		if(crc != reference) {
+			result = 2;
+		}
+	}
+
+	free(data);
+	return result;
+}